@@ -0,0 +1,144 @@
+/*
+  apply.c
+
+  (C)2026 Henryk Richter <henryk.richter@gmx.net>
+
+  purpose:
+   Headless mode. Load a preset file, send it to the keyboard in
+   one go and quit. No window, no commodity, only exec and dos
+   are touched.
+
+   A500KBConfig APPLY=ENVARC:A500KB.prefs [SAVE]
+   A500KBConfig STRIPNOTE=FF0000 [NOTETIME=2000]
+
+*/
+#include <exec/types.h>
+#include <exec/execbase.h>
+#include <exec/memory.h>
+
+#define __NOLIBBASE__
+#include <proto/exec.h>
+#include <proto/dos.h>
+
+#include "apply.h"
+#include "ledmanager.h"
+#include "utils.h"
+
+LONG apply_main( struct configvars *conf )
+{
+	LONG res,ret;
+
+	if( ledmanager_init() )
+	{
+		Printf( (STRPTR)"cannot access keyboard serial line\n" );
+		return RETURN_FAIL;
+	}
+
+	res = ledmanager_loadpresets( (STRPTR)conf->apply );
+	if( res != 0 )
+	{
+		Printf( (STRPTR)"cannot load preset file %s\n", (ULONG)conf->apply );
+		ledmanager_exit();
+		return RETURN_ERROR;
+	}
+
+	/* no answer: classic keyboard or not connected */
+	if( ledmanager_getversion() != KCMD_ACK )
+	{
+		Printf( (STRPTR)"no reply from keyboard\n" );
+		ledmanager_exit();
+		return RETURN_WARN;
+	}
+
+	/* before the batch, so that SAVE includes it; a refused setting
+	   (e.g. firmware older than 11/12) leaves the rest going out */
+	ret = RETURN_OK;
+	if( conf->fade && (ledmanager_setFade( -1, *conf->fade ) != KCMD_ACK) )
+	{
+		Printf( (STRPTR)"FADE refused by keyboard (firmware older than 11/12?)\n" );
+		ret = RETURN_WARN;
+	}
+	if( conf->dim || conf->idletime )
+	{
+		res = ledmanager_setDim( (conf->dim)      ? *conf->dim      : 100,
+		                         (conf->idledim)  ? *conf->idledim  : 0,
+		                         (conf->idletime) ? *conf->idletime : 0 );
+		if( res != KCMD_ACK )
+		{
+			Printf( (STRPTR)"DIM/IDLEDIM/IDLETIME refused by keyboard (firmware older than 11/12?)\n" );
+			ret = RETURN_WARN;
+		}
+	}
+	if( conf->striplen && (ledmanager_setStripLen( *conf->striplen ) != KCMD_ACK) )
+	{
+		Printf( (STRPTR)"STRIPLEN refused by keyboard (1...144, firmware 11/12)\n" );
+		ret = RETURN_WARN;
+	}
+	if( conf->stripprog )
+	{
+		res = ledmanager_loadStripProg( (STRPTR)conf->stripprog );
+		if( res == -3 )
+			Printf( (STRPTR)"cannot open strip program %s\n", (ULONG)conf->stripprog );
+		else if( res == -2 )
+			Printf( (STRPTR)"strip program %s: invalid size (even, max. 96 bytes)\n", (ULONG)conf->stripprog );
+		else if( res != 0 )
+			Printf( (STRPTR)"strip program %s refused by keyboard (invalid or firmware older than 11/12)\n", (ULONG)conf->stripprog );
+		if( res != 0 )
+			ret = RETURN_WARN; /* the LEDs still go out (and get saved) */
+	}
+	if( conf->stack )
+	{
+		res = ledmanager_setStacks( (STRPTR)conf->stack );
+		if( res == -2 )
+			Printf( (STRPTR)"STACK: syntax error in \"%s\"\n", (ULONG)conf->stack );
+		else if( res != 0 )
+			Printf( (STRPTR)"STACK refused by keyboard (firmware older than 11/12?)\n" );
+		if( res != 0 )
+			ret = RETURN_WARN;
+	}
+
+	res = ledmanager_sendBatch( N_LED, (conf->save) ? LEDM_BATCH_SAVE : 0 );
+	ledmanager_exit();
+
+	if( res != KCMD_ACK )
+	{
+		Printf( (STRPTR)"transfer to keyboard failed\n" );
+		return RETURN_ERROR;
+	}
+
+	return ret;
+}
+
+
+LONG apply_note( struct configvars *conf )
+{
+	STRPTR col = (STRPTR)conf->stripnote;
+	ULONG  alpha;
+	LONG   res;
+
+	if( ledmanager_init() )
+	{
+		Printf( (STRPTR)"cannot access keyboard serial line\n" );
+		return RETURN_FAIL;
+	}
+
+	if( ledmanager_getversion() != KCMD_ACK )
+	{
+		Printf( (STRPTR)"no reply from keyboard\n" );
+		ledmanager_exit();
+		return RETURN_WARN;
+	}
+
+	alpha = ( (col[0] | 32) == 'o' ) ? 0 : 255; /* OFF */
+	res = ledmanager_stripNote( (alpha) ? Hex2LONG( col ) : 0, alpha,
+	                            (conf->notetime) ? *conf->notetime : 0 );
+	ledmanager_exit();
+
+	if( res != KCMD_ACK )
+	{
+		Printf( (STRPTR)"strip notification failed (needs firmware 11/12)\n" );
+		return RETURN_ERROR;
+	}
+
+	return RETURN_OK;
+}
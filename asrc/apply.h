@@ -0,0 +1,39 @@
+/*
+  apply.h
+
+  (C)2026 Henryk Richter <henryk.richter@gmx.net>
+
+  purpose:
+   headless mode: send a preset file to the keyboard without
+   opening the GUI (for use in S:User-Startup), or a notification
+   on top of the LED strip (for scripts)
+
+*/
+#ifndef _INC_APPLY_H
+#define _INC_APPLY_H
+
+#include <exec/types.h>
+#include <dos/dos.h>
+
+#include "config.h" /* config descriptor structure */
+
+#ifndef DOSLIBTYPE
+#ifdef __SASC
+#define DOSLIBTYPE DosLibrary
+#else
+#define DOSLIBTYPE Library
+#endif
+#endif
+
+LONG apply_main( struct configvars *conf );
+LONG apply_note( struct configvars *conf );
+
+#ifndef _INC_EXT_SYS_DOS_ICON
+#define _INC_EXT_SYS_DOS_ICON
+/* Libraries initialized in Startup */
+extern struct DOSLIBTYPE *DOSBase;
+extern struct Library   *SysBase;
+extern struct Library   *IconBase;
+#endif /* _INC_EXT_SYS_DOS_ICON */
+
+#endif /* _INC_APPLY_H */
@@ -10,6 +10,7 @@
 
 #include "compiler.h"
 #include <exec/types.h>
+#include <exec/tasks.h>
 
 ASM LONG CIAKB_Init( void );
 
@@ -25,6 +26,11 @@ ASM LONG CIAKB_Stop( void );
 
 ASM LONG CIAKB_Exit( void );
 
+/* keyboard notifications (source state changes), signal task on arrival */
+ASM LONG CIAKB_SetNotify( ASMR(a1) struct Task *task ASMREG(a1),   /* NULL = off */
+                          ASMR(d0) ULONG sigmask     ASMREG(d0) );
+ASM LONG CIAKB_GetNotify( void ); /* state 0...0x7f or -1 if nothing new */
+
 /* keyboard returns ACK/NACK when an incoming sequence was detected
    or does nothing when the start of sequence was missed, also a 
    classic keyboard won't answer at all */
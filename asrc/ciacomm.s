@@ -34,6 +34,7 @@ CMD_ACK		EQU	$80|$73	;ACK = OK
 CMD_NACK	EQU	$80|$77	;failed reception
 CMD_TIMEOUT	EQU	$5A	;no answer
 CMD_ACK1        EQU     $80|$7B ;ACK1 = ack command, please wait
+CMD_NOTIFY	EQU	$80|$75	;source state change, next byte = state|$80
 
 TIMEOUT_WAIT2	EQU	50	;in 92 ms units -> 50 equals 4.6s
 	;
@@ -43,6 +44,8 @@ TIMEOUT_WAIT2	EQU	50	;in 92 ms units -> 50 equals 4.6s
 	XDEF	 _CIAKB_IsBusy  ;
 	XDEF	 _CIAKB_GetData ;get data stream (after CIAKB_Wait)
 	XDEF	 _CIAKB_Stop	;stop sending instance (implicit in "Wait")
+	XDEF	 _CIAKB_SetNotify ;task/signal for keyboard notifications
+	XDEF	 _CIAKB_GetNotify ;get last notified source state
 	XDEF	_CIAKB_Exit	;shutdown
 
 
@@ -188,6 +191,7 @@ _CIAKB_Exit:
 	move.w	cia_allocated(pc),d0
 	beq.s	.rts
 
+	clr.l	kbnotify_task			;no more notifications
 	bsr	_CIAKB_Stop			;
 
 	lea	_ciaa,a0
@@ -213,6 +217,32 @@ _CIAKB_Exit:
 	rts
 
 
+; Set task to be signalled on keyboard notifications
+;  A1 = task (NULL = off)
+;  D0 = signal mask
+; Returns: 0
+_CIAKB_SetNotify:
+	clr.l	kbnotify_task			;disarm first, interrupt may come in
+	clr.b	kbnotify_next
+	clr.b	kbnotify_new
+	move.l	d0,kbnotify_mask
+	move.l	a1,kbnotify_task
+	moveq	#0,d0
+	rts
+
+; Get last source state notified by the keyboard (void)
+; Returns: state (0...$7f) or -1 if nothing new arrived
+_CIAKB_GetNotify:
+	moveq	#-1,d0
+	move.b	kbnotify_new(pc),d1
+	beq.s	.rts
+	clr.b	kbnotify_new			;clear before reading: a newer state will just be reported twice
+	moveq	#0,d0
+	move.b	kbnotify_state(pc),d0
+.rts:
+	rts
+
+
 _CIAKB_IsBusy:
 	moveq	#0,d0
 	move.w  cia_allocated(pc),d0
@@ -566,6 +596,36 @@ CIAKB_KeyboardInt:
 	ror.b	#1,d1				;Bit7 = UP(1)/DOWN(0)
 	not.b	d1				;invert to get actual keycode
 
+	;source state notifications: CMD_NOTIFY,state|$80 (only when somebody listens)
+	move.l	kbnotify_task(pc),d0
+	beq.s	.nonotify
+	move.b	kbsend_sending(pc),d0
+	beq.s	.checknotify
+	move.w	kback1off(pc),d0		;ACK1 seen: everything up to ACK belongs to the reply
+	bge.s	.nonotify
+.checknotify:
+	move.b	kbnotify_next(pc),d0
+	beq.s	.notifycode
+	clr.b	kbnotify_next
+	tst.b	d1				;state comes as key-up code
+	bpl.s	.nonotify			;lost a byte: this is a regular key
+	move.b	d1,d0
+	and.b	#$7f,d0
+	move.b	d0,kbnotify_state
+	move.b	#1,kbnotify_new
+	bsr	CIAKB_SendNotify		;preserves registers
+	bra.s	.notifyswallow
+.notifycode:
+	cmp.b	#CMD_NOTIFY,d1
+	bne.s	.nonotify
+	move.b	#1,kbnotify_next
+.notifyswallow:
+	or.b    #CIACRAF_SPMODE,_ciaa+ciacra		;handshake, don't pass to keyboard.device
+	bsr	Delay75us
+	and.b   #~(CIACRAF_SPMODE)&$ff,_ciaa+ciacra	;
+	bra	.rts
+.nonotify:
+
 	move.b	kbsend_sending(pc),d0		;stays on until ACK/NACK or timeout
 	beq.s	.notsending
 
@@ -661,6 +721,19 @@ CIAKB_SendSignal:
 	movem.l	(sp)+,d0/d1/a0/a1/a6
 	rts
 
+; preserves registers
+CIAKB_SendNotify:
+	movem.l	d0/d1/a0/a1/a6,-(sp)
+	move.l	4.w,a6
+	move.l	kbnotify_task(pc),d0
+	beq.s	.nosig
+	move.l	d0,a1
+	move.l	kbnotify_mask(pc),d0
+	jsr	_LVOSignal(A6)
+.nosig:
+	movem.l	(sp)+,d0/d1/a0/a1/a6
+	rts
+
 ; 75us busy loop
 Delay75us:
 	move.l	d0,-(sp)
@@ -702,6 +775,13 @@ kbsend_sending:	dc.b	0	;still sending?
 kbsend_timercount: dc.b 0	;return when 0, send signal when reaching 0
 kbsend_result:	dc.b	0	;result (CMD_ACK,CMD_NACK,CMD_TIMEOUT)
 
+kbnotify_task:	dc.l	0	;task to signal on CMD_NOTIFY (0 = off)
+kbnotify_mask:	dc.l	0
+kbnotify_next:	dc.b	0	;1 = CMD_NOTIFY seen, next byte is state
+kbnotify_state:	dc.b	0	;last notified state
+kbnotify_new:	dc.b	0	;1 = state not fetched yet
+		dc.b	0	;align
+
 ; 
 kbsend_num:	 dc.l	0	;total sent bytes (debug)
 kback1off:	 dc.w	0	;offset of CMD_ACK1 in current command cycle (-1)
@@ -13,7 +13,7 @@
 /* Important: apply changes to both confstringCLI and confvarsWB, also don't forget to
    adjust struct configvars accordingly as that struct is the direct result of a call
    to ReadArgs() */
-STRPTR confstringCLI = (STRPTR)"CX_POPUP/K,CX_POPKEY/K,PRIORITY/K/N,WINX/K/N,WINY/K/N,FONTNAME/K,FONTSIZE/K/N";
+STRPTR confstringCLI = (STRPTR)"CX_POPUP/K,CX_POPKEY/K,PRIORITY/K/N,WINX/K/N,WINY/K/N,FONTNAME/K,FONTSIZE/K/N,APPLY/K,SAVE/S,VSRC1/K,VSRC2/K,FADE/K/N,DIM/K/N,IDLEDIM/K/N,IDLETIME/K/N,STRIPLEN/K/N,STRIPPROG/K,STRIPNOTE/K,NOTETIME/K/N,STACK/K";
 
 /* every item here should shadow the position and type in confstringCLI */
 struct configttitem confvarsWB[] = {
@@ -24,6 +24,19 @@ struct configttitem confvarsWB[] = {
  { (STRPTR)"WINY",      CTTI_INT    },
  { (STRPTR)"FONTNAME",  CTTI_STRING },
  { (STRPTR)"FONTSIZE",  CTTI_INT    },
+ { (STRPTR)"APPLY",     CTTI_STRING },
+ { (STRPTR)"SAVE",      CTTI_SWITCH },
+ { (STRPTR)"VSRC1",     CTTI_STRING },
+ { (STRPTR)"VSRC2",     CTTI_STRING },
+ { (STRPTR)"FADE",      CTTI_INT    },
+ { (STRPTR)"DIM",       CTTI_INT    },
+ { (STRPTR)"IDLEDIM",   CTTI_INT    },
+ { (STRPTR)"IDLETIME",  CTTI_INT    },
+ { (STRPTR)"STRIPLEN",  CTTI_INT    },
+ { (STRPTR)"STRIPPROG", CTTI_STRING },
+ { (STRPTR)"STRIPNOTE", CTTI_STRING },
+ { (STRPTR)"NOTETIME",  CTTI_INT    },
+ { (STRPTR)"STACK",     CTTI_STRING },
  { NULL, 0 }
 };
 
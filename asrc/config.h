@@ -24,6 +24,19 @@ struct configvars {
 	ULONG	*win_y;
 	APTR    fontname;
 	ULONG   *fontsize;
+	APTR    apply;   /* preset file: send to keyboard and quit */
+	ULONG   save;    /* with APPLY: store in keyboard's EEPROM */
+	APTR    vsrc1;   /* virtual source 1: "CPU" or device name */
+	APTR    vsrc2;   /* virtual source 2: "CPU" or device name */
+	ULONG   *fade;   /* LED state transition time in ms (all analog LEDs) */
+	ULONG   *dim;    /* brightness in percent (all analog LEDs) */
+	ULONG   *idledim;  /* brightness in percent after IDLETIME */
+	ULONG   *idletime; /* minutes without key activity until IDLEDIM */
+	ULONG   *striplen; /* number of LEDs on the strip */
+	APTR    stripprog; /* bytecode file for the "Program" strip FX */
+	APTR    stripnote; /* notification color RRGGBB on the strip ("OFF" = clear): send and quit */
+	ULONG   *notetime; /* with STRIPNOTE: fade out time in ms (0 = hold) */
+	APTR    stack;     /* priority stacks "<led>:<src>=<state>,...[:RRGGBB] ..." */
 
 	/* ----------- safekeeping for CLI args from RDArgs --------- */
 	APTR	args;	 /* RDArgs */
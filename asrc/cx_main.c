@@ -35,6 +35,8 @@
 #include "ledmanager.h"
 #include "capsimage.h"
 #include "savereq.h"
+#include "vsrc.h"
+#include "ciacomm.h"
 
 const STRPTR cx_Name = (STRPTR)"A500KBConfig";
 STRPTR cx_Desc = (STRPTR)"Keyboard Configurator," \
@@ -102,6 +104,9 @@ LONG cx_main( struct configvars *conf )
 
   struct MsgPort *TimerPort = NULL;
   struct timerequest *timerio = NULL;
+  LONG   nvsrc = 0;
+  ULONG  vsrc_last = 0;
+  LONG   notify_sig = -1;
 
   cust.eventport = 0;
   cust.eventreq  = 0;
@@ -172,6 +177,66 @@ LONG cx_main( struct configvars *conf )
 	/* Load Config from Keyboard (with or without main window) */
 	LoadConfig_Req( mywin );
 
+	if( conf->fade )
+		ledmanager_setFade( -1, *conf->fade );
+	if( conf->dim || conf->idletime )
+		ledmanager_setDim( (conf->dim)      ? *conf->dim      : 100,
+		                   (conf->idledim)  ? *conf->idledim  : 0,
+		                   (conf->idletime) ? *conf->idletime : 0 );
+	if( conf->striplen )
+		ledmanager_setStripLen( *conf->striplen );
+	if( conf->stripprog )
+	{
+		if( ledmanager_loadStripProg( (STRPTR)conf->stripprog ) != 0 )
+		{
+		        ULONG iflags = 0;
+   			const struct EasyStruct progES = {
+		           sizeof (struct EasyStruct),
+	        	   0,
+		           (STRPTR)"Error",
+			   (STRPTR)"Cannot send strip program %s.\n(missing file, invalid program\n or firmware older than 11/12)",
+		           (STRPTR)"OK",
+		       };
+		       EasyRequest( NULL, (struct EasyStruct*)&progES, &iflags, (ULONG)conf->stripprog );
+		}
+	}
+	if( conf->stack )
+	{
+		if( ledmanager_setStacks( (STRPTR)conf->stack ) != 0 )
+		{
+		        ULONG iflags = 0;
+   			const struct EasyStruct stackES = {
+		           sizeof (struct EasyStruct),
+	        	   0,
+		           (STRPTR)"Error",
+			   (STRPTR)"Cannot send priority stacks\n%s\n(syntax error or firmware older than 11/12)",
+		           (STRPTR)"OK",
+		       };
+		       EasyRequest( NULL, (struct EasyStruct*)&stackES, &iflags, (ULONG)conf->stack );
+		}
+	}
+
+	/* live source states from keyboard (needs keyboard version) */
+	if( (notify_sig = AllocSignal( -1 )) >= 0 )
+	{
+		CIAKB_SetNotify( FindTask(NULL), 1<<notify_sig );
+		if( ledmanager_setNotify( 1 ) != KCMD_ACK )
+		{
+			CIAKB_SetNotify( NULL, 0 );
+			FreeSignal( notify_sig );
+			notify_sig = -1;
+		}
+	}
+
+	/* activity monitor for virtual sources (needs keyboard version) */
+	if( (nvsrc = vsrc_init( conf )) > 0 )
+	{
+		timerio->tr_node.io_Command = TR_ADDREQUEST;
+		timerio->tr_time.tv_secs  = 0;
+		timerio->tr_time.tv_micro = VSRC_TICK;
+		SendIO((struct IORequest *) timerio);
+	}
+
 	{
 	 UBYTE flg = 1;
 	 if( conf->cx_popup )
@@ -199,6 +264,8 @@ LONG cx_main( struct configvars *conf )
 		/* SIGBREAKF_CTRL_F with window */
 		ULONG signals = (1<<cx_Port->mp_SigBit) | SIGBREAKF_CTRL_C | SIGBREAKF_CTRL_E | SIGBREAKF_CTRL_F;
 		signals |= (1<<TimerPort->mp_SigBit);
+		if( notify_sig >= 0 )
+			signals |= (1<<notify_sig);
 #ifdef GET_TICKS_FILTER
 		signals |= (1<<cx_Signal); 
 #endif
@@ -212,6 +279,28 @@ LONG cx_main( struct configvars *conf )
 
 		if( signals & 1<<TimerPort->mp_SigBit)
 		{
+			if( nvsrc > 0 )
+			{
+				if( CheckIO((struct IORequest *)timerio) )
+				{
+					ULONG vs;
+
+					WaitIO((struct IORequest *)timerio);
+					/* only sent on state changes */
+					vs = vsrc_poll();
+					ledmanager_setVSrc( vs );
+					ledmanager_sendConfig( -1 );
+					/* not notified by the keyboard: update live view here */
+					if( mywin && (vs != vsrc_last) )
+						Window_LiveState( conf, mywin );
+					vsrc_last = vs;
+
+					timerio->tr_node.io_Command = TR_ADDREQUEST;
+					timerio->tr_time.tv_secs  = 0;
+					timerio->tr_time.tv_micro = VSRC_TICK;
+					SendIO((struct IORequest *) timerio);
+				}
+			}
 //			RestartTimer( timerio, interval );
 			/* Tell Window to update */
 			if( mywin )
@@ -220,6 +309,17 @@ LONG cx_main( struct configvars *conf )
 //				Window_Sigmask = flg;
 		}
 
+		if( (notify_sig >= 0) && (signals & (1<<notify_sig)) )
+		{
+			LONG st = CIAKB_GetNotify();
+			if( st >= 0 )
+			{
+				ledmanager_setLiveSources( st );
+				if( mywin )
+					Window_LiveState( conf, mywin );
+			}
+		}
+
 #ifdef GET_TICKS_FILTER
 		if( signals & (1<<cx_Signal) )
 		{
@@ -250,10 +350,37 @@ LONG cx_main( struct configvars *conf )
 
   Window_Destroy(conf, mywin ); /* close and stay closed */
 
+  if( nvsrc > 0 )
+  {
+	LONG i;
+
+	vsrc_exit();
+
+	/* leave virtual sources off */
+	ledmanager_setVSrc( 0 );
+	for( i=0 ; i < 25 ; i++ )
+	{
+		if( ledmanager_sendConfig( -1 ) & KCMD_NOWORK )
+			break;
+		Delay( 2 );
+	}
+  }
+
+  if( notify_sig >= 0 )
+  {
+	if( CIAKB_IsBusy() ) /* config transfer still underway */
+		CIAKB_Wait();
+	ledmanager_setNotify( 0 );
+	CIAKB_SetNotify( NULL, 0 );
+	FreeSignal( notify_sig );
+  }
+
   /* Close Timer */
   if( TimerBase )
   {
 	AbortIO((struct IORequest *) timerio);
+	if( nvsrc > 0 )
+		WaitIO((struct IORequest *) timerio);
         CloseDevice((struct IORequest *) timerio);
   }
   if( timerio )
@@ -13,6 +13,8 @@
 */
 #include "compiler.h"
 #include "ledmanager.h"
+#include "stripframe.h"
+#include "utils.h"
 //#include "ciacomm.h" // see ledmanager.h
 #include <proto/exec.h>
 #include <proto/dos.h>
@@ -29,13 +31,24 @@ unsigned char  LED_MODES[N_LED+N_DIGITAL_LED];  /* static,cycle, rainbow, knight
 unsigned short LED_lastSRCMAP[N_LED+N_DIGITAL_LED][LED_STATES];
 unsigned char  LED_lastRGB[N_LED+N_DIGITAL_LED][LED_STATES][3]; /* RGB config for LEDs */
 unsigned char  LED_lastMODES[N_LED+N_DIGITAL_LED];  /* static,cycle, rainbow, knight rider etc. */
-#define MAXMODE 3 /* static,cycle1,cycle2,cycle3 */
+#define MAXMODE (LEDM_NMODES-1)
 
-UBYTE cmdstream[54]; /* 2 bytes preamble, 1 CMD SOURCE (2 bytes), 3 CMDs RGB (5 bytes each) */
+/* config as received from Keyboard (for ENV: cache) */
+UBYTE LED_rawcfg[N_LED+N_DIGITAL_LED][LEDM_CFGSIZE];
+
+UBYTE cmdstream[LEDM_MAXSTREAM]; /* 2 bytes preamble, per LED: 1 CMD SOURCE (2 bytes), 3 CMDs RGB (5 bytes each), 1 CMD MODE (2 bytes) */
 SHORT lastchange;    /* index of last LED that was changed in config tool */
 SHORT lastsent;
 SHORT retries;       /* we try to re-send data a couple of times */
 SHORT needcfg;       /* we need to save current config in EEPROM */
+UBYTE vsrc_bits;     /* virtual sources: requested state */
+UBYTE vsrc_sent;     /* virtual sources: state acknowledged by keyboard */
+UBYTE vsrc_insend;   /* virtual sources: state in last transmission */
+#define VSRC_UNKNOWN (LEDX_VSRC_MASK+1)
+struct stripframe_state ledm_frame; /* strip frames: mirror of keyboard state */
+SHORT ledm_frameidle;               /* unchanged frames not sent */
+LONG  ledm_livesrc;                 /* source state as notified by keyboard (-1 = unknown) */
+#define FRAME_KEEPALIVE 32          /* keyboard falls back to effects after ~8s */
 #define NRETRIES 10
 
 #define LEMCF_CHK 1
@@ -44,8 +57,11 @@ SHORT needcfg;       /* we need to save current config in EEPROM */
 void led_defaults(void);
 LONG ledmanager_copy_last( LONG led, LONG flags ); /* copy LED settings to last sent location */
 LONG ledmanager_sendcommands( LONG led ); /* generate command stream and send data */
+LONG ledmanager_transfer( UBYTE *cmd, LONG ncmd ); /* synchronous send with retries */
+UBYTE *ledmanager_putled( UBYTE *cmd, LONG led ); /* append commands for one LED */
 
 /* referenced for version-specific commands */
+extern LONG keyboard_type;
 extern LONG keyboard_version;
 
 LONG ledmanager_init(void)
@@ -54,6 +70,12 @@ LONG ledmanager_init(void)
 	lastchange = -1; /* no LED config was changed recently */
 	lastsent   = -1; /* last attempted transmission LED index */
 	needcfg    =  0; /* we don't need to send save command */
+	vsrc_bits  = VSRC_UNKNOWN; /* virtual sources unused until set */
+	vsrc_sent  = VSRC_UNKNOWN;
+	stripframe_setlength( &ledm_frame, SF_NLED );
+	stripframe_reset( &ledm_frame );
+	ledm_frameidle = 0;
+	ledm_livesrc   = -1;
 
 	return CIAKB_Init();
 }
@@ -70,6 +92,21 @@ LONG ledmanager_saveEEPROM(void)
 	return ledmanager_sendConfig( LEDIDX_SAVEEEPROM );
 }
 
+/* 
+  set virtual sources, the command is sent by ledmanager_sendConfig()
+  when no LED config is pending and only if the state differs from
+  the last acknowledged one
+*/
+LONG ledmanager_setVSrc( ULONG bits )
+{
+	if( keyboard_version < LEDGV_VERSION_VSRC )
+		return -1;
+
+	vsrc_bits = (UBYTE)(bits & LEDX_VSRC_MASK);
+
+	return 0;
+}
+
 /*
   Send configuration changes to keyboard
    - check last changed LED first
@@ -105,6 +142,8 @@ LONG ledmanager_sendConfig( LONG tosendled )
 			ledmanager_copy_last( lastsent, 0 );
 			if( lastsent == LEDIDX_SAVEEEPROM )
 				needcfg = 0;
+			if( lastsent == LEDIDX_VSRC )
+				vsrc_sent = vsrc_insend;
 			lastsent = -1; /* ok, done.  */
 			retries  =  0; /* no retries */
 		}
@@ -133,6 +172,9 @@ LONG ledmanager_sendConfig( LONG tosendled )
 			if( tosendled == (N_LED+N_DIGITAL_LED) )
 				tosendled = -1;
 		}
+		/* lowest priority: virtual source state */
+		if( (tosendled < 0) && (vsrc_bits != vsrc_sent) && (vsrc_bits != VSRC_UNKNOWN) )
+			tosendled = LEDIDX_VSRC;
 	}
 
 	if( tosendled >= 0 )
@@ -156,7 +198,6 @@ LONG ledmanager_sendcommands( LONG led )
 {
 	UBYTE *cmd = cmdstream;
 	LONG  ncmd;// = 0;
-	LONG  act,sec,res,i;
 
 	/* preamble */
 	*cmd++ = 0x00;
@@ -166,7 +207,30 @@ LONG ledmanager_sendcommands( LONG led )
 	{
 		*cmd++ = LEDCMD_SAVEEEPROM;
 	}
+	else if( led == LEDIDX_VSRC )
+	{
+		vsrc_insend = vsrc_bits;
+		*cmd++ = LEDCMD_EXT | LEDX_SETVSRC | vsrc_insend;
+	}
 	else
+		cmd = ledmanager_putled( cmd, led );
+
+	ncmd = cmd - cmdstream;
+
+	/* 0==OK, else FAIL */
+	return CIAKB_Send( cmdstream, ncmd );
+//	return 0;
+}
+
+
+/*
+  append source, color and mode commands for one LED to a command stream,
+  returns new end of stream (LEDM_LEDSTREAM bytes per LED, at most)
+*/
+UBYTE *ledmanager_putled( UBYTE *cmd, LONG led )
+{
+	LONG  act,sec,res,i;
+
 	{
 		/* source mapping:
 		   if LED_ACTIVE < LED_SECONDARY, then send inverse flag
@@ -207,11 +271,534 @@ LONG ledmanager_sendcommands( LONG led )
 		}
 	}
 
-	ncmd = cmd - cmdstream;
+	return cmd;
+}
 
-	/* 0==OK, else FAIL */
-	return CIAKB_Send( cmdstream, ncmd );
-//	return 0;
+
+/*
+  synchronous transfer of a prepared command stream (including preamble)
+  with retries, returns KCMD_ACK on success
+*/
+LONG ledmanager_transfer( UBYTE *cmd, LONG ncmd )
+{
+	LONG res = KCMD_TIMEOUT;
+	SHORT i;
+
+	for( i=0 ; i < NRETRIES ; i++ )
+	{
+		if( CIAKB_Send( cmd, ncmd ) != 0 )
+			return KCMD_NACK;
+		res = CIAKB_Wait();
+		if( res == KCMD_ACK )
+			break;
+	}
+
+	return res;
+}
+
+
+/*
+  get keyboard type and firmware version (synchronous)
+  returns KCMD_ACK on success
+*/
+LONG ledmanager_getversion( void )
+{
+	UBYTE buf[8];
+	LONG  res;
+
+	cmdstream[0] = 0x00;
+	cmdstream[1] = 0x03;
+	cmdstream[2] = LEDCMD_GETVERSION;
+
+	res = ledmanager_transfer( cmdstream, 3 );
+	if( res == KCMD_ACK )
+	{
+		if( (CIAKB_GetData( buf, 8 ) >= 3) && (buf[0] == LEDGV_HEADER) )
+		{
+			keyboard_type    = buf[1];
+			keyboard_version = buf[2];
+		}
+		else	res = KCMD_NACK;
+	}
+
+	return res;
+}
+
+
+/*
+  send config of LEDs 0...nleds-1 to keyboard and wait for the result,
+  optionally save to EEPROM (flags: LEDM_BATCH_SAVE)
+
+  As many LEDs as the firmware accepts are packed into one command
+  stream (6 LEDs since 11/12, one LED before), the save command is
+  appended to the last stream.
+
+  returns KCMD_ACK on success
+*/
+LONG ledmanager_sendBatch( LONG nleds, ULONG flags )
+{
+	UBYTE *cmd;
+	LONG  res = KCMD_ACK;
+	LONG  led,maxstream;
+
+	if( (ULONG)nleds > (N_LED+N_DIGITAL_LED) )
+		return KCMD_NACK;
+
+	maxstream = ( keyboard_version >= LEDGV_VERSION_CRC ) ? LEDM_FWSTREAM : LEDM_FWSTREAM_OLD;
+
+	led = 0;
+	while( (res == KCMD_ACK) && ( (led < nleds) || (flags & LEDM_BATCH_SAVE) ) )
+	{
+		/* preamble */
+		cmd = cmdstream;
+		*cmd++ = 0x00;
+		*cmd++ = 0x03;
+
+		while( (led < nleds) && ( (cmd - cmdstream) - 2 + LEDM_LEDSTREAM <= maxstream ) )
+			cmd = ledmanager_putled( cmd, led++ );
+
+		if( (led >= nleds) && (flags & LEDM_BATCH_SAVE) && ( (cmd - cmdstream) - 2 < maxstream ) )
+		{
+			*cmd++ = LEDCMD_SAVEEEPROM;
+			flags &= ~LEDM_BATCH_SAVE;
+		}
+
+		res = ledmanager_transfer( cmdstream, cmd - cmdstream );
+	}
+
+	if( res == KCMD_ACK )
+	{
+		for( led=0 ; led < nleds ; led++ )
+			ledmanager_copy_last( led, 0 );
+	}
+
+	return res;
+}
+
+
+/*
+  send one LED strip frame (nleds pixels R,G,B, as set by STRIPLEN),
+  encoded as delta against the previous frame, returns KCMD_ACK on success
+
+  unchanged frames are skipped, except for a periodic keepalive; a frame
+  that exceeds one stream (long strips with many colors) goes out in
+  several streams
+*/
+LONG ledmanager_sendFrame( UBYTE *rgb, ULONG nleds )
+{
+	UBYTE *cmd;
+	LONG  n,res;
+
+	if( keyboard_version < LEDGV_VERSION_FRAME )
+		return KCMD_NACK;
+
+	stripframe_setlength( &ledm_frame, (nleds > LEDX_MAXSTRIP) ? LEDX_MAXSTRIP : nleds );
+	do
+	{
+		cmd = cmdstream;
+		*cmd++ = 0x00;
+		*cmd++ = 0x03;
+		*cmd++ = LEDCMD_EXT | LEDX_FRAME;
+		/* stream limit minus command and length byte */
+		n = stripframe_encode( &ledm_frame, cmd+1, LEDM_FWSTREAM-2, rgb );
+		if( (n == 0) && (++ledm_frameidle < FRAME_KEEPALIVE) )
+			return KCMD_ACK;
+		ledm_frameidle = 0;
+		*cmd++ = (UBYTE)n;
+		cmd += n;
+
+		res = ledmanager_transfer( cmdstream, cmd - cmdstream );
+		if( res != KCMD_ACK )
+		{
+			stripframe_reset( &ledm_frame ); /* unknown state on keyboard: send full frame next time */
+			break;
+		}
+	}
+	while( ledm_frame.pending );
+
+	return res;
+}
+
+
+/* leave streaming mode, keyboard continues with configured effect */
+LONG ledmanager_stopFrames( void )
+{
+	if( keyboard_version < LEDGV_VERSION_FRAME )
+		return KCMD_NACK;
+
+	cmdstream[0] = 0x00;
+	cmdstream[1] = 0x03;
+	cmdstream[2] = LEDCMD_EXT | LEDX_FRAME;
+	cmdstream[3] = 1;
+	cmdstream[4] = SF_OP_OFF;
+	stripframe_reset( &ledm_frame );
+
+	return ledmanager_transfer( cmdstream, 5 );
+}
+
+
+/*
+  ask keyboard to report source state changes (on=1) or stop it (on=0),
+  returns KCMD_ACK on success
+*/
+LONG ledmanager_setNotify( ULONG on )
+{
+	if( keyboard_version < LEDGV_VERSION_NOTIFY )
+		return KCMD_NACK;
+
+	ledm_livesrc = -1;
+
+	cmdstream[0] = 0x00;
+	cmdstream[1] = 0x03;
+	cmdstream[2] = LEDCMD_EXT | LEDX_NOTIFY | ( (on) ? 1 : 0 );
+
+	return ledmanager_transfer( cmdstream, 3 );
+}
+
+
+/*
+  crossfade time between idle/active/secondary in ms, rounded to
+  animation frames of the firmware (max. 255 frames = 8.4s)
+*/
+LONG ledmanager_setFade( LONG led, ULONG ms )
+{
+	ULONG frames = (ms + LEDX_FADEFRAME/2) / LEDX_FADEFRAME;
+
+	if( keyboard_version < LEDGV_VERSION_FADE )
+		return KCMD_NACK;
+	if( frames > 255 )
+		frames = 255;
+
+	cmdstream[0] = 0x00;
+	cmdstream[1] = 0x03;
+	cmdstream[2] = LEDCMD_EXT | LEDX_SETFADE;
+	cmdstream[3] = (led < 0) ? 0xFF : (UBYTE)led;
+	cmdstream[4] = (UBYTE)frames;
+
+	return ledmanager_transfer( cmdstream, 5 );
+}
+
+
+/*
+  brightness through the current registers of the LED controller,
+  percent mapped to 0...255
+*/
+LONG ledmanager_setDim( ULONG percent, ULONG idlepercent, ULONG minutes )
+{
+	if( keyboard_version < LEDGV_VERSION_DIM )
+		return KCMD_NACK;
+	if( percent > 100 )
+		percent = 100;
+	if( idlepercent > 100 )
+		idlepercent = 100;
+	if( minutes > 255 )
+		minutes = 255;
+
+	cmdstream[0] = 0x00;
+	cmdstream[1] = 0x03;
+	cmdstream[2] = LEDCMD_EXT | LEDX_SETDIM;
+	cmdstream[3] = (UBYTE)( (percent*255 + 50)/100 );
+	cmdstream[4] = (UBYTE)( (idlepercent*255 + 50)/100 );
+	cmdstream[5] = (UBYTE)minutes;
+
+	return ledmanager_transfer( cmdstream, 6 );
+}
+
+
+/*
+  more than two prioritized sources for an LED: the first entry
+  with an active source decides the LED state
+*/
+LONG ledmanager_setStack( LONG led, LONG n, UBYTE *stack, UBYTE *rgb4 )
+{
+	UBYTE *cmd = cmdstream;
+	LONG i;
+
+	if( keyboard_version < LEDGV_VERSION_STACK )
+		return KCMD_NACK;
+	if( ((ULONG)led >= N_LED) || ((ULONG)n > LEDX_MAXSTACK) )
+		return KCMD_NACK;
+
+	*cmd++ = 0x00;
+	*cmd++ = 0x03;
+	*cmd++ = LEDCMD_EXT | LEDX_SETSTACK;
+	*cmd++ = (UBYTE)led;
+	*cmd++ = (UBYTE)n;
+	for( i=0 ; i < n*2 ; i++ )
+		*cmd++ = *stack++;
+
+	if( rgb4 )
+	{
+		*cmd++ = LEDCMD_COLOR | led;
+		*cmd++ = LEDX_STATE4;
+		*cmd++ = rgb4[0];
+		*cmd++ = rgb4[1];
+		*cmd++ = rgb4[2];
+	}
+
+	return ledmanager_transfer( cmdstream, cmd-cmdstream );
+}
+
+
+/* source names in priority stacks (STACK argument) */
+static const struct {
+	char  name[7];
+	UBYTE mask;
+} ledm_stacksrc[] = {
+	{ "POWER",  LEDF_SRC_POWER  },
+	{ "PDIM",   LEDX_SRC_PDIM   },
+	{ "FLOPPY", LEDF_SRC_FLOPPY },
+	{ "IN3",    LEDF_SRC_IN3    },
+	{ "IN4",    LEDF_SRC_IN4    },
+	{ "CAPS",   LEDF_SRC_CAPS   },
+	{ "VIRT1",  LEDF_SRC_VIRT1  },
+	{ "VIRT2",  LEDF_SRC_VIRT2  },
+	{ "",       0 }
+};
+
+/* one source name (any case), returns position after the name or NULL */
+static UBYTE *ledmanager_stacksrc( UBYTE *s, UBYTE *mask )
+{
+	SHORT i,j;
+
+	for( i=0 ; ledm_stacksrc[i].mask ; i++ )
+	{
+		for( j=0 ; ledm_stacksrc[i].name[j] ; j++ )
+		{
+			if( (s[j] & ~32) != (ledm_stacksrc[i].name[j] & ~32) )
+				break;
+		}
+		if( !ledm_stacksrc[i].name[j] )
+		{
+			*mask |= ledm_stacksrc[i].mask;
+			return s+j;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+  priority stacks from text, LEDs separated by blanks:
+   <led>[:<src>[+<src>...]=<state>[,...][:RRGGBB]]
+  led 0-6 (Floppy 0-2, Power 0-2, Caps), state 0-3 (Off, On, 2nd, 4th
+  color RRGGBB), a bare <led> returns to the regular source mapping.
+  Everything is checked before the first LED goes out.
+*/
+LONG ledmanager_setStacks( STRPTR spec )
+{
+	UBYTE stack[N_LED][LEDX_MAXSTACK*2];
+	UBYTE rgb4[N_LED][3];
+	BYTE  nstack[N_LED];
+	UBYTE hasrgb = 0;
+	UBYTE *s = (UBYTE*)spec;
+	LONG  led,n,k,col;
+
+	for( led=0 ; led < N_LED ; led++ )
+		nstack[led] = -1; /* not given */
+
+	while( *s )
+	{
+		if( *s == ' ' )
+		{
+			s++;
+			continue;
+		}
+		led = *s++ - '0';
+		if( ((ULONG)led >= N_LED) || (nstack[led] >= 0) )
+			return -2;
+		n = 0;
+		if( *s == ':' )
+		{
+			/* entries: src[+src...]=state, separated by "," */
+			do
+			{
+				if( n >= LEDX_MAXSTACK )
+					return -2;
+				stack[led][n*2] = 0;
+				do
+				{
+					if( !(s = ledmanager_stacksrc( s+1, &stack[led][n*2] )) )
+						return -2;
+				}
+				while( *s == '+' );
+				if( (s[0] != '=') || (s[1] < '0') || (s[1] > '0'+LEDX_STATE4) )
+					return -2;
+				stack[led][n*2+1] = s[1] - '0';
+				s += 2;
+				n++;
+			}
+			while( *s == ',' );
+
+			/* optional color of the 4th state */
+			if( *s == ':' )
+			{
+				col = Hex2LONG( (STRPTR)++s );
+				for( k=0 ; k < 6 ; k++, s++ )
+				{
+					if( !( ((*s >= '0') && (*s <= '9')) ||
+					       (((*s & ~32) >= 'A') && ((*s & ~32) <= 'F')) ) )
+						return -2;
+				}
+				rgb4[led][0] = (UBYTE)(col>>16);
+				rgb4[led][1] = (UBYTE)(col>>8);
+				rgb4[led][2] = (UBYTE)col;
+				hasrgb |= (1<<led);
+			}
+		}
+		if( *s && (*s != ' ') )
+			return -2;
+		nstack[led] = n;
+	}
+
+	for( led=0 ; led < N_LED ; led++ )
+	{
+		if( nstack[led] < 0 )
+			continue;
+		if( ledmanager_setStack( led, nstack[led], stack[led],
+		                         (hasrgb & (1<<led)) ? rgb4[led] : NULL ) != KCMD_ACK )
+			return -1;
+	}
+
+	return 0;
+}
+
+
+LONG ledmanager_setStripLen( ULONG nleds )
+{
+	if( keyboard_version < LEDGV_VERSION_STRIP )
+		return KCMD_NACK;
+	if( (nleds < 1) || (nleds > LEDX_MAXSTRIP) )
+		return KCMD_NACK;
+
+	cmdstream[0] = 0x00;
+	cmdstream[1] = 0x03;
+	cmdstream[2] = LEDCMD_EXT | LEDX_SETSTRIP;
+	cmdstream[3] = (UBYTE)nleds;
+
+	return ledmanager_transfer( cmdstream, 4 );
+}
+
+
+LONG ledmanager_stripNote( ULONG rgb, ULONG alpha, ULONG ms )
+{
+	ULONG frames;
+
+	if( keyboard_version < LEDGV_VERSION_STRIPNOTE )
+		return KCMD_NACK;
+	if( alpha > 255 )
+		alpha = 255;
+	frames = (ms + LEDX_FADEFRAME/2) / LEDX_FADEFRAME; /* strip frame = 2 timer ticks, too */
+	if( frames > 255 )
+		frames = 255;
+	if( ms && !frames )
+		frames = 1;
+
+	cmdstream[0] = 0x00;
+	cmdstream[1] = 0x03;
+	cmdstream[2] = LEDCMD_EXT | LEDX_STRIPNOTE;
+	cmdstream[3] = (UBYTE)alpha;
+	cmdstream[4] = (UBYTE)(rgb>>16);
+	cmdstream[5] = (UBYTE)(rgb>>8);
+	cmdstream[6] = (UBYTE)rgb;
+	cmdstream[7] = (UBYTE)frames;
+
+	return ledmanager_transfer( cmdstream, 8 );
+}
+
+
+LONG ledmanager_setStripProg( UBYTE *code, ULONG len )
+{
+	UBYTE buf[8];
+	ULONG i;
+	LONG  res;
+
+	if( keyboard_version < LEDGV_VERSION_PROG )
+		return KCMD_NACK;
+	if( (len > LEDX_MAXPROG) || (len & 1) )
+		return KCMD_NACK;
+
+	cmdstream[0] = 0x00;
+	cmdstream[1] = 0x03;
+	cmdstream[2] = LEDCMD_EXT | LEDX_SETPROG;
+	cmdstream[3] = (UBYTE)len;
+	for( i = 0 ; i < len ; i++ )
+		cmdstream[4+i] = code[i];
+
+	res = ledmanager_transfer( cmdstream, 4+len );
+	if( res == KCMD_ACK )
+	{
+		/* 0xBA, accepted, active length */
+		if( (CIAKB_GetData( buf, 8 ) < 3) || (buf[0] != LEDGV_HEADER) || !buf[1] )
+			res = KCMD_NACK;
+	}
+
+	return res;
+}
+
+
+LONG ledmanager_loadStripProg( STRPTR fname )
+{
+	UBYTE code[LEDX_MAXPROG+1];
+	BPTR  ifile;
+	LONG  len;
+
+	ifile = Open( fname, MODE_OLDFILE );
+	if( !ifile )
+		return -3;
+	len = Read( ifile, code, LEDX_MAXPROG+1 );
+	Close( ifile );
+
+	if( (len < 0) || (len > LEDX_MAXPROG) || (len & 1) ) /* too long: not truncated */
+		return -2;
+
+	return ( ledmanager_setStripProg( code, len ) == KCMD_ACK ) ? 0 : -1;
+}
+
+
+/* notified state to source flags (PDIM as in priority stacks) */
+void ledmanager_setLiveSources( LONG sources )
+{
+	if( sources < 0 )
+	{
+		ledm_livesrc = -1;
+		return;
+	}
+	ledm_livesrc = sources & (LEDF_SRC_POWER|LEDF_SRC_FLOPPY|LEDF_SRC_IN3|LEDF_SRC_IN4|LEDF_SRC_CAPS);
+	if( sources & LEDX_NOTIFY_PDIM )
+		ledm_livesrc |= LEDX_SRC_PDIM;
+}
+
+
+/*
+  state of an LED under the last notified sources, same decision as
+  in the firmware: primary source wins, secondary only lights while
+  the primary is off
+
+  returns LED_IDLE,LED_ACTIVE,LED_SECONDARY or -1 if unknown
+*/
+LONG ledmanager_getLiveState( LONG led )
+{
+	LONG act,sec,src;
+
+	if( ledm_livesrc < 0 )
+		return -1;
+	if( (ULONG)led >= N_LED )
+		return LED_ACTIVE; /* LED strip: effects are not source driven */
+
+	/* virtual sources: our own, as requested */
+	src = ledm_livesrc;
+	if( vsrc_bits != VSRC_UNKNOWN )
+		src |= (LONG)vsrc_bits << LEDB_SRC_VIRT1;
+
+	act = LED_SRCMAP[led][LED_ACTIVE];
+	sec = LED_SRCMAP[led][LED_SECONDARY];
+	if( (act != LEDB_SRC_INACTIVE) && (src & (1<<act)) )
+		return LED_ACTIVE;
+	if( (sec != LEDB_SRC_INACTIVE) && (src & (1<<sec)) )
+		return LED_SECONDARY;
+
+	return LED_IDLE;
 }
 
 
@@ -280,6 +867,7 @@ ULONG ledmanager_decodesrcmap( ULONG srcmap, ULONG which )
 /* load single configuration entry */
 LONG ledmanager_loadconfigentry( LONG led, UBYTE *recvbuf, LONG nbytes, ULONG flags )
 {
+	UBYTE *raw = recvbuf;
 	SHORT i;
 
 	if( (ULONG)led >= (N_LED+N_DIGITAL_LED) )
@@ -308,7 +896,7 @@ LONG ledmanager_loadconfigentry( LONG led, UBYTE *recvbuf, LONG nbytes, ULONG fl
 	if( nbytes == 11 )
 	{
 		LED_MODES[led] = *recvbuf;
-		if( (LED_MODES[led] > MAXMODE) && (led < N_LED)  )
+		if( ((LED_MODES[led] & MSK_MODELED) > MAXMODE) && (led < N_LED)  )
 			LED_MODES[led] = 0;
 	}
 
@@ -318,6 +906,10 @@ LONG ledmanager_loadconfigentry( LONG led, UBYTE *recvbuf, LONG nbytes, ULONG fl
 		   need to send these parameters back
 		*/
 		ledmanager_copy_last( led, 0 );
+
+		/* keep a verbatim copy for the config cache */
+		for( i=0 ; i < LEDM_CFGSIZE ; i++ )
+			LED_rawcfg[led][i] = (i < nbytes) ? raw[i] : 0;
 	}
 
 	return 0;
@@ -691,6 +1283,99 @@ LONG ledmanager_copy_last( LONG led, LONG flags )
 	return 0;
 }
 
+#define CACHE_NAME (STRPTR)"ENV:A500KBConfig.cache"
+#define CACHE_HDR  0xBAFFCAC4
+struct ledm_Cache {
+	ULONG  Header;
+	USHORT Version;
+	USHORT CRC;   /* config CRC as reported by keyboard */
+	USHORT nLED;  /* number of valid entries in cfg    */
+	UBYTE  cfg[N_LED+N_DIGITAL_LED][LEDM_CFGSIZE];
+};
+
+/*
+  load config from ENV: cache instead of reading it back from the keyboard
+
+  The cache is valid if the stored CRC matches the one reported
+  by the keyboard and the number of entries fits the keyboard version.
+*/
+LONG ledmanager_loadcache( ULONG crc, LONG nleds )
+{
+	struct ledm_Cache *ca;
+	BPTR  ifile;
+	LONG  ret = -2;
+	SHORT i;
+
+	ca = (struct ledm_Cache *)AllocVec( sizeof( struct ledm_Cache ), MEMF_PUBLIC );
+	if( !ca )
+		return -1;
+
+	ifile = Open( CACHE_NAME, MODE_OLDFILE );
+	if( !ifile )
+	{
+		FreeVec( ca );
+		return -3;
+	}
+
+	if( Read( ifile, ca, sizeof( struct ledm_Cache ) ) == sizeof( struct ledm_Cache ) )
+	{
+		if( (ca->Header  == CACHE_HDR) &&
+		    (ca->Version == 1 ) &&
+		    (ca->CRC     == (USHORT)crc ) &&
+		    (ca->nLED    == nleds ) &&
+		    (nleds <= (N_LED+N_DIGITAL_LED) )
+		  )
+		{
+			for( i = 0 ; i < nleds ; i++ )
+				ledmanager_loadconfigentry( i, ca->cfg[i], LEDM_CFGSIZE, 1 );
+			ret = nleds;
+		}
+	}
+	Close( ifile );
+
+	FreeVec( ca );
+
+	return ret;
+}
+
+LONG ledmanager_savecache( ULONG crc, LONG nleds )
+{
+	struct ledm_Cache *ca;
+	BPTR  ofile;
+	LONG  ret = 0;
+	SHORT i,j;
+
+	if( (ULONG)nleds > (N_LED+N_DIGITAL_LED) )
+		return -2;
+
+	ca = (struct ledm_Cache *)AllocVec( sizeof( struct ledm_Cache ), MEMF_PUBLIC|MEMF_CLEAR );
+	if( !ca )
+		return -1;
+
+	ca->Header  = CACHE_HDR;
+	ca->Version = 1;
+	ca->CRC     = (USHORT)crc;
+	ca->nLED    = nleds;
+	for( i = 0 ; i < nleds ; i++ )
+	{
+		for( j = 0 ; j < LEDM_CFGSIZE ; j++ )
+			ca->cfg[i][j] = LED_rawcfg[i][j];
+	}
+
+	ofile = Open( CACHE_NAME, MODE_NEWFILE );
+	if( ofile )
+	{
+		Write( ofile, ca, sizeof( struct ledm_Cache ) );
+		Close( ofile );
+	}
+	else
+		ret = -2;
+
+	FreeVec( ca );
+
+	return ret;
+}
+
 #define HDR 0xBAFFEEDD
 #define PRE_NLED 7
 struct ledm_Preset {
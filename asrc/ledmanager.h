@@ -20,6 +20,8 @@
 
 /* virtual 9th LED for save config command */
 #define LEDIDX_SAVEEEPROM (N_LED+N_DIGITAL_LED)
+/* virtual 10th LED for virtual sources command */
+#define LEDIDX_VSRC (N_LED+N_DIGITAL_LED+1)
 
 /* possible LED states */
 #define LED_IDLE      0 /* idle             */
@@ -33,6 +35,8 @@
 #define LEDB_SRC_IN3    2
 #define LEDB_SRC_IN4    3
 #define LEDB_SRC_CAPS   4
+#define LEDB_SRC_VIRT1  5 /* virtual sources, set by ledmanager_setVSrc() */
+#define LEDB_SRC_VIRT2  6
 #define LEDB_SRC_SWAP     7 /* Keyboard send: swap primary/secondary */
 #define LEDB_SRC_INACTIVE 8 /* dummy in software configurator */
 #define LEDF_SRC_POWER  (1<<LEDB_SRC_POWER)
@@ -40,6 +44,8 @@
 #define LEDF_SRC_IN3    (1<<LEDB_SRC_IN3)
 #define LEDF_SRC_IN4    (1<<LEDB_SRC_IN4)
 #define LEDF_SRC_CAPS   (1<<LEDB_SRC_CAPS)
+#define LEDF_SRC_VIRT1  (1<<LEDB_SRC_VIRT1)
+#define LEDF_SRC_VIRT2  (1<<LEDB_SRC_VIRT2)
 #define LEDF_SRC_SWAP   (1<<LEDB_SRC_SWAP)
 #define LEDF_SRC_INACTIVE (1<<LEDB_SRC_INACTIVE) /* dummy in software configurator */
 
@@ -60,9 +66,39 @@
 #define LEDCMD_GETVERSION 0xA0
 /* set mode (static, cycle etc.), 1 byte argument */
 #define LEDCMD_SETMODE    0xC0
+/* extended commands: the lower 5 bits carry a sub-command instead of an LED index */
+#define LEDCMD_EXT        0xE0
+
+/* sub-commands of LEDCMD_EXT */
+#define LEDX_GETCRC       0x00 /* get CRC16 of active LED config, returns 0xBA,CRC_H,CRC_L */
+#define LEDX_SETVSRC      0x04 /* set virtual sources, state in lower 2 bits (VIRT1=bit0) */
+#define LEDX_VSRC_MASK    0x03
+#define LEDX_FRAME        0x08 /* LED strip frame: 1 byte length, then frame opcodes (see stripframe.h) */
+#define LEDX_NOTIFY       0x0A /* source change notifications, 0x0A = off, 0x0B = on */
+#define LEDX_SETFADE      0x0C /* state transition time: 1 byte LED (0xFF = all), 1 byte time in frames */
+#define LEDX_FADEFRAME    33   /* ms per frame of the firmware animation engine */
+#define LEDX_SETDIM       0x0D /* brightness: 1 byte brightness, 1 byte idle brightness (0...255), 1 byte idle time in minutes */
+#define LEDX_SETSTACK     0x0E /* priority stack: 1 byte LED, 1 byte N (0 = back to source map), N * (source mask, state) */
+#define LEDX_SETSTRIP     0x0F /* LED strip length: 1 byte number of LEDs (0 = default) */
+#define LEDX_STRIPNOTE    0x10 /* LED strip notification: 1 byte alpha (0 = off), R,G,B, 1 byte fade out time in frames (0 = hold) */
+#define LEDX_SETPROG      0x11 /* LED strip effect program: 1 byte length, then bytecode (see stripvm.c), stored in EEPROM,
+                                  returns 0xBA,1 = accepted (0 = rejected),length of the active program */
+#define LEDX_MAXSTRIP     144  /* max. LED strip length */
+#define LEDX_MAXPROG      96   /* max. LED strip effect program size in bytes */
+#define LEDX_MAXSTACK     4    /* max. entries of a priority stack */
+#define LEDX_STATE4       3    /* 4th LED state (only reachable by a priority stack) */
+#define LEDX_SRC_PDIM     0x80 /* source in priority stacks: power LED dimmed (A500 audio filter off), POWER = bright */
+#define LEDX_NOTIFY_PDIM  0x20 /* PDIM in source change notifications (the virtual sources are not notified) */
 
 /* mode mask for LED strip FX (upper bits are for flags like RGB/BGR) */
 #define MSK_MODESTRIP 0xf
+/* strip mode flag: splash of pressed keys on top of any strip FX (LEDD_FXREACT) */
+#define REACT_MODESTRIP 0x40
+/* mode mask for the analog LEDs (upper bits: animation speed, 0 = default, 1...15 = slow...fast) */
+#define MSK_MODELED   0xf
+/* number of analog LED modes: Fixed,CycleH,CycleV,CycleS,Activity,Strip FX (LEDM_NMODES in src/led.h) */
+#define LEDM_NMODES   6
+#define SHIFT_MODESPEED 4
 
 /* Please note that the protocol is designed for short packets to avoid
    overflows in send/receive buffers. As a consequence, only one command
@@ -79,6 +115,30 @@
 #define LEDGV_TYPE_A3000 0x02 /* 1 LED only */
 #define LEDGV_TYPE_A500MINI 0x03
 #define LEDGV_VERSION    0x01 /* software version */
+#define LEDGV_VERSION_CRC 11  /* first firmware version that supports LEDX_GETCRC */
+#define LEDGV_VERSION_VSRC 11 /* first firmware version that supports LEDX_SETVSRC */
+#define LEDGV_VERSION_FRAME 11 /* first firmware version that supports LEDX_FRAME */
+#define LEDGV_VERSION_NOTIFY 11 /* first firmware version that supports LEDX_NOTIFY */
+#define LEDGV_VERSION_FADE 11 /* first firmware version that supports LEDX_SETFADE */
+#define LEDGV_VERSION_DIM  11 /* first firmware version that supports LEDX_SETDIM */
+#define LEDGV_VERSION_STACK 11 /* first firmware version that supports LEDX_SETSTACK */
+#define LEDGV_VERSION_STRIP 11 /* first firmware version that supports LEDX_SETSTRIP */
+#define LEDGV_VERSION_STRIPNOTE 11 /* first firmware version that supports LEDX_STRIPNOTE */
+#define LEDGV_VERSION_PROG 11 /* first firmware version that supports LEDX_SETPROG */
+
+/* size of one LEDCMD_GETCONFIG reply (SRCMAP,3*RGB,MODE) */
+#define LEDM_CFGSIZE 11
+
+/* command stream sizes: per LED (SOURCE 2, 3*COLOR 5, MODE 2),
+   max. stream the firmware accepts (w/o preamble): 32 bytes
+   before V11/12, 127 bytes since then */
+#define LEDM_LEDSTREAM 19
+#define LEDM_FWSTREAM_OLD 32
+#define LEDM_FWSTREAM 127
+#define LEDM_MAXSTREAM (2+LEDM_FWSTREAM)
+
+/* flags for ledmanager_sendBatch() */
+#define LEDM_BATCH_SAVE 1
 
 /* see index mapping in ledmanager.c, should be consecutive */
 #define LEDPR_A500RED 0x1
@@ -100,6 +160,60 @@ LONG ledmanager_loadconfigentry( LONG led, UBYTE *recvbuf, LONG nbytes, ULONG fl
 LONG ledmanager_sendConfig(LONG led);
 /* store config in Keyboard's eeprom */
 LONG ledmanager_saveEEPROM(void);
+/* set virtual sources (bit0=VIRT1, bit1=VIRT2), sent by ledmanager_sendConfig() */
+LONG ledmanager_setVSrc( ULONG bits );
+
+/* synchronous calls (no GUI): get version, send LEDs 0..nleds-1 in one go */
+LONG ledmanager_getversion( void );
+LONG ledmanager_sendBatch( LONG nleds, ULONG flags );
+
+/* synchronous: stream LED strip frames (rgb = nleds*R,G,B, 1...LEDX_MAXSTRIP,
+   same as STRIPLEN), long frames take more than one stream, stop streaming */
+LONG ledmanager_sendFrame( UBYTE *rgb, ULONG nleds );
+LONG ledmanager_stopFrames( void );
+
+/* synchronous: enable/disable source change notifications (see CIAKB_SetNotify),
+   live state: sources as notified (-1 = unknown), get LED_IDLE/ACTIVE/SECONDARY (-1 = unknown) */
+LONG ledmanager_setNotify( ULONG on );
+void ledmanager_setLiveSources( LONG sources );
+LONG ledmanager_getLiveState( LONG led );
+
+/* synchronous: crossfade time between LED states in ms (led -1 = all analog LEDs),
+   stored in EEPROM with the next save */
+LONG ledmanager_setFade( LONG led, ULONG ms );
+
+/* synchronous: brightness of all analog LEDs in percent, idle brightness after
+   "minutes" without key activity (0 = never), stored in EEPROM with the next save */
+LONG ledmanager_setDim( ULONG percent, ULONG idlepercent, ULONG minutes );
+
+/* synchronous: priority stack of an LED, n pairs of (source flags, state), highest
+   priority first, n=0 = back to the regular source mapping; rgb4 (optional, 3 bytes)
+   = color of LEDX_STATE4, stored in EEPROM with the next save */
+LONG ledmanager_setStack( LONG led, LONG n, UBYTE *stack, UBYTE *rgb4 );
+/* priority stacks from text (STACK argument), see ledmanager.c, returns 0 = ok,
+   -1 = refused by keyboard (or firmware too old), -2 = syntax error */
+LONG ledmanager_setStacks( STRPTR spec );
+
+/* synchronous: number of LEDs on the strip (1...LEDX_MAXSTRIP), stored in
+   EEPROM with the next save */
+LONG ledmanager_setStripLen( ULONG nleds );
+
+/* synchronous: notification on top of the LED strip, crossfade to rgb (0xRRGGBB)
+   with alpha 0...255 (0 = off), fading out over ms (0 = hold), not stored */
+LONG ledmanager_stripNote( ULONG rgb, ULONG alpha, ULONG ms );
+
+/* synchronous: program for the "Program" strip FX, len bytes of bytecode as
+   written by stripvm (len=0 clears it), stored in EEPROM with the next save,
+   returns KCMD_NACK when the keyboard refused it (jump out of the program);
+   loadStripProg() sends a bytecode file, returns 0 = ok, -1 = refused by
+   keyboard (or firmware too old), -2 = invalid size, -3 = cannot open */
+LONG ledmanager_setStripProg( UBYTE *code, ULONG len );
+LONG ledmanager_loadStripProg( STRPTR fname );
+
+/* config cache in ENV:, keyed by the config CRC reported by the keyboard
+   load returns the number of restored LEDs (or <0 on mismatch/failure) */
+LONG ledmanager_loadcache( ULONG crc, LONG nleds );
+LONG ledmanager_savecache( ULONG crc, LONG nleds );
 
 LONG ledmanager_getColor(LONG led,LONG state,LONG rgb);
 LONG ledmanager_getSrc(LONG led,LONG state);
@@ -6,6 +6,10 @@
   Generate a table that performs the decision about primary/secondary LED
   color for custom Keyboard
 
+  Also checks the firmware's priority stacks (led.c: led_srcmapstack(),
+  led_buildstatetab()) against the original two source + swap decision
+  (get_secmap()) for all source maps and source states.
+
 */
 #include <stdio.h>
 
@@ -24,6 +28,7 @@ UBYTE LED_DSTMAP[256];
 #define NBITS 7
 
 LONG ledmanager_sendcommands( LONG led );
+LONG check_stacks( void );
 
 int main( int argc, char **argv )
 {
@@ -106,7 +111,7 @@ int main( int argc, char **argv )
 
  ledmanager_sendcommands( 0 );
 
- return 0;
+ return ( check_stacks() ) ? 1 : 0;
 }
 
 /*
@@ -141,3 +146,136 @@ LONG ledmanager_sendcommands( LONG led )
 }
 
 
+/* ---------------- firmware state resolution check ------------------- */
+#define LEDF_ALL      0x7f
+#define LEDF_MAP_SWAP 0x80
+#define LED_IDLE      0
+#define LED_MAXSTACK  4
+
+/* original firmware: bit combinations (including SWAP flag) for secondary function */
+UBYTE get_secmap( UBYTE srcmap )
+{
+	UBYTE ret;
+	int j,pripos,secpos;
+
+	pripos = -1;
+	secpos = -1;
+	for( j = 0 ; j < 7 ; j++ )
+	{
+		if( srcmap & (1<<j) )
+		{
+			pripos = j;
+			j++;
+			break;
+		}
+	}
+	for(  ; j < 7 ; j++ )
+	{
+		if( srcmap & (1<<j) )
+		{
+			secpos = j;
+			break;
+		}
+	}
+
+	ret = 0xff;
+	if( pripos >= 0 )
+	{
+		if( srcmap & 0x80 )
+		{
+			if( secpos >= 0 )
+				pripos = secpos;
+			ret = 0x80 | (1<<pripos);
+		}
+		else
+		{
+			if( secpos >= 0 )
+				ret = (1<<pripos);
+		}
+	}
+	return ret;
+}
+
+UBYTE old_ledstate( UBYTE srcmap, UBYTE state )
+{
+	UBYTE t = srcmap & (state|0x80);
+
+	if( get_secmap( srcmap ) == t )
+		return LED_SECONDARY;
+	return (t&0x7f) ? LED_ACTIVE : LED_IDLE;
+}
+
+/* same as led_srcmapstack() in firmware */
+void srcmapstack( UBYTE stack[LED_MAXSTACK][2], UBYTE srcmap )
+{
+	UBYTE map = srcmap & LEDF_ALL;
+	UBYTE lo,hi,sec;
+	UBYTE *e = &stack[0][0];
+
+	lo = map & (UBYTE)(-map);
+	hi = map & ~lo;
+	hi = hi & (UBYTE)(-hi);
+
+	if( srcmap & LEDF_MAP_SWAP )
+		sec = (hi) ? hi : lo;
+	else	sec = (hi) ? lo : 0;
+
+	if( map & ~sec )
+	{
+		*e++ = map & ~sec;
+		*e++ = LED_ACTIVE;
+	}
+	if( sec )
+	{
+		*e++ = sec;
+		*e++ = LED_SECONDARY;
+	}
+	*e = 0;
+}
+
+/* same as led_buildstatetab() + led_ledstate() in firmware */
+UBYTE stackstate( UBYTE stack[LED_MAXSTACK][2], UBYTE state )
+{
+	UBYTE tab[(LEDF_ALL+1)/4];
+	int s,k;
+	UBYTE t;
+
+	for( s=0 ; s <= LEDF_ALL ; s++ )
+	{
+		t = LED_IDLE;
+		for( k=0 ; (k < LED_MAXSTACK) && stack[k][0] ; k++ )
+		{
+			if( s & stack[k][0] )
+			{
+				t = stack[k][1];
+				break;
+			}
+		}
+		if( !(s&3) )
+			tab[s>>2] = 0;
+		tab[s>>2] |= t<<((s&3)<<1);
+	}
+
+	state &= LEDF_ALL;
+	return ( tab[state>>2] >> ((state&3)<<1) ) & 3;
+}
+
+LONG check_stacks( void )
+{
+	UBYTE stack[LED_MAXSTACK][2];
+	int map,state;
+	LONG err = 0;
+
+	for( map=0 ; map < 256 ; map++ )
+	{
+		srcmapstack( stack, map );
+		for( state=0 ; state <= LEDF_ALL ; state++ )
+		{
+			if( stackstate( stack, state ) != old_ledstate( map, state ) )
+				err++;
+		}
+	}
+
+	fprintf( stderr, "priority stacks: %d mismatches in %d source maps * %d states\n", (int)err, 256, LEDF_ALL+1 );
+	return err;
+}
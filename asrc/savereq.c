@@ -144,10 +144,13 @@ void LoadConfig_Req( struct myWindow *win )
 
 UBYTE lc_cmdstream[4];
 UBYTE lc_recvbuffer[64];
+ULONG lc_crc;      /* config CRC reported by keyboard */
+SHORT lc_havecrc;  /* 1 = lc_crc is valid */
 LONG LoadConfig_Func( struct myWindow *win, ULONG *state )
 {
 #define LCS_LEDs     15	       /* last possible index reserved for identification string */
 #define LCS_SENT     (1<<4)
+#define LCS_CRC      (1<<5)    /* config CRC requested (between version and config) */
 #define LCS_TOADD    (1<<24)   /* timeout addition */
 #define LCS_TOMASK   (255<<24) /* mask for timeouts */
 #define LCS_TOTHRESH (20<<24)  /* give up after 20 timeouts */
@@ -161,7 +164,7 @@ LONG LoadConfig_Func( struct myWindow *win, ULONG *state )
   remember number of timeouts and successful transmissions
 
   state variable: (0..7)&15 = LED index (4 bit)
-                  (16..32)  = action code (START=0<<4,SENT=1<<4) (2 bit)
+                  (16..32)  = action code (START=0<<4,SENT=1<<4,CRC=1<<5) (2 bit)
 		  (N.b)<<16 = successful calls
 		  (M.b)<<24 = timeouts
 */
@@ -174,8 +177,14 @@ LONG LoadConfig_Func( struct myWindow *win, ULONG *state )
 		lc_cmdstream[0] = 0x00;
 		lc_cmdstream[1] = 0x03;
 
-		if( idx == -1 )
+		if( *state & LCS_CRC )
 		{
+			lc_cmdstream[2] = LEDCMD_EXT | LEDX_GETCRC;
+			n = 3;
+		}
+		else if( idx == -1 )
+		{
+			lc_havecrc = 0;
 			lc_cmdstream[2] = LEDCMD_GETVERSION;
 			n = 3;
 		}
@@ -207,7 +216,24 @@ LONG LoadConfig_Func( struct myWindow *win, ULONG *state )
 		LONG n = CIAKB_GetData( lc_recvbuffer, 64 );
 		if( n > 1 )
 		{
-			if( idx == -1 )
+			LONG nleds = LCS_NLEDs;
+
+			if( *state & LCS_CRC )
+			{
+				/* getcrc -> 0xBA,CRC_H,CRC_L */
+				*state &= ~(LCS_CRC);
+				if( (lc_recvbuffer[0] == 0xBA) && (n >= 3) )
+				{
+					lc_crc     = ((ULONG)lc_recvbuffer[1]<<8) | (ULONG)lc_recvbuffer[2];
+					lc_havecrc = 1;
+					if( (keyboard_version > 4) && (keyboard_version&1) )
+						nleds += LCS_NLEDsDIGI;
+					/* unchanged config since last start: no readback */
+					if( ledmanager_loadcache( lc_crc, nleds ) == nleds )
+						return nleds;
+				}
+			}
+			else if( idx == -1 )
 			{
 				/* getconfig -> 0xBA,(LEDGV_TYPE_A500/LEDGV_TYPE_A3000),VERSION */
 				if( lc_recvbuffer[0] == 0xBA )
@@ -215,6 +241,12 @@ LONG LoadConfig_Func( struct myWindow *win, ULONG *state )
 					keyboard_type    = lc_recvbuffer[1];
 					keyboard_version = lc_recvbuffer[2];
 				}
+				/* ask for config CRC first, if supported */
+				if( keyboard_version >= LEDGV_VERSION_CRC )
+				{
+					*state |= LCS_CRC;
+					return -1;
+				}
 			}
 			else
 			{
@@ -224,13 +256,11 @@ LONG LoadConfig_Func( struct myWindow *win, ULONG *state )
 			/* next LED or "done" */
 			idx++;
 			if( (keyboard_version > 4) && (keyboard_version&1) )
+				nleds = LCS_NLEDs+LCS_NLEDsDIGI;
+			if( idx >= nleds )
 			{
-			 if( idx >= (LCS_NLEDs+LCS_NLEDsDIGI) )
-				return idx;		/* done */
-			}
-			else
-			{
-			 if( idx >= LCS_NLEDs )
+				if( lc_havecrc )
+					ledmanager_savecache( lc_crc, idx );
 				return idx;		/* done */
 			}
 			idx++; /* "-1" in the beginning of the file */
@@ -0,0 +1,199 @@
+/*
+  splashlat.c
+
+  (c) 2026 Henryk Richter
+
+  Host model of the keyboard main loop for the splash effect of the LED
+  strip: time from a key press until the last byte of the first frame
+  that shows it has left the strip output ("keypress to photon").
+  Compares frames on the timer tick only with the immediate frame after
+  a key event (led_digital_poll(), at most one per tick).
+
+  build: cc -O2 -o splashlat splashlat.c
+
+  Timing model (see led_digital_step()/led_digital_poll() and main.c):
+   - Timer2 tick every 16.384 ms, a frame on every 2nd tick (LED_DELAY 1)
+   - key events are seen at the start of a main loop pass
+   - a pass costs PASS_US plus at most one output slice
+   - effect fill on the tick (or splash step on the key event), then
+     overlays with splash coverage, hash, wire image and bit-banged
+     transfer in slices (6 LEDs with one splash, 96 bytes, 8 LEDs,
+     32 bytes)
+   - slice and render times are estimates from cycle counts
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+
+#define TICK_US        16384
+#define LED_DELAY      1
+#define PASS_US        30
+#define RENDER_US_LED  2    /* effect fill per LED */
+#define COMP_LEDS      6    /* LEDD_SLICE_COMP/(5+1): layers and one splash */
+#define COMP_US        80
+#define HASH_US        60   /* 96 bytes */
+#define WIRE_LEDS      8    /* LEDD_SLICE_WIRE */
+#define WIRE_US        100
+#define SEND_US        107  /* 32 bytes, bit-banged */
+#define NKEYS          20000
+#define KEYGAP_MIN_US  40000 /* keys well apart: no interaction */
+#define KEYGAP_RND_US  200000
+
+#define PH_IDLE 0
+#define PH_COMP 1
+#define PH_HASH 2
+#define PH_WIRE 3
+#define PH_SEND 4
+
+struct result {
+	double avg;
+	long   p95;
+	long   max;
+	int    nframes;
+};
+
+int cmp_long( const void *a, const void *b )
+{
+	long x = *(const long*)a, y = *(const long*)b;
+
+	return (x > y) - (x < y);
+}
+
+void simulate( int nled, int immediate, struct result *res )
+{
+ static long lat[NKEYS];
+ long t,nexttick,keyt,framekey,cost;
+ int dly,phase,left,kick,kickok,nk,shown,nframes;
+ double sum;
+
+ srand( 1 );
+ t = 0;
+ nexttick = TICK_US;
+ dly = LED_DELAY;
+ phase = PH_IDLE;
+ left = 0;
+ kick = kickok = 0;
+ nk = 0;
+ nframes = 0;
+ keyt = KEYGAP_MIN_US + rand()%KEYGAP_RND_US;
+ shown = 1;     /* current key already on its way (or none pending) */
+ framekey = -1; /* key time carried by the frame in the pipeline */
+
+ while( nk < NKEYS )
+ {
+	cost = PASS_US;
+
+	/* key scan */
+	if( shown && (t >= keyt) )
+	{
+		shown = 0;
+		kick  = 1;
+	}
+
+	/* timer tick: led_digital_step() */
+	if( t >= nexttick )
+	{
+		nexttick += TICK_US;
+		kickok = 1;
+		if( dly > 0 )
+			dly--;
+		else if( phase == PH_IDLE )
+		{
+			dly   = LED_DELAY;
+			kick  = 0;
+			cost += nled*RENDER_US_LED;
+			phase = PH_COMP;
+			left  = (nled+COMP_LEDS-1)/COMP_LEDS;
+			framekey = ( !shown ) ? keyt : -1;
+			nframes++;
+		}
+	}
+
+	/* led_digital_poll(): immediate frame, then one slice */
+	if( immediate && kick && kickok && (phase == PH_IDLE) )
+	{
+		kick = kickok = 0;
+		phase = PH_COMP; /* same base, splash step only */
+		left  = (nled+COMP_LEDS-1)/COMP_LEDS;
+		framekey = keyt;
+		nframes++;
+	}
+	switch( phase )
+	{
+		case PH_COMP:
+			cost += COMP_US;
+			if( !--left )
+			{
+				phase = PH_HASH;
+				left  = (nled*3+95)/96;
+			}
+			break;
+		case PH_HASH:
+			cost += HASH_US;
+			if( !--left )
+			{
+				phase = PH_WIRE;
+				left  = (nled+WIRE_LEDS-1)/WIRE_LEDS;
+			}
+			break;
+		case PH_WIRE:
+			cost += WIRE_US;
+			if( !--left )
+			{
+				phase = PH_SEND;
+				left  = (4+nled*4+4+31)/32; /* start, pixels, end frame */
+			}
+			break;
+		case PH_SEND:
+			cost += SEND_US;
+			if( !--left )
+			{
+				phase = PH_IDLE;
+				if( framekey >= 0 )
+				{
+					lat[nk++] = t + cost - framekey;
+					framekey = -1;
+					shown = 1;
+					keyt = t + cost + KEYGAP_MIN_US + rand()%KEYGAP_RND_US;
+				}
+			}
+			break;
+		default:
+			break;
+	}
+
+	t += cost;
+ }
+
+ sum = 0;
+ for( nk = 0 ; nk < NKEYS ; nk++ )
+	sum += lat[nk];
+ qsort( lat, NKEYS, sizeof(long), cmp_long );
+
+ res->avg = sum / NKEYS;
+ res->p95 = lat[NKEYS*95/100];
+ res->max = lat[NKEYS-1];
+ res->nframes = nframes;
+}
+
+
+int main( void )
+{
+ static const int lens[] = { 15, 60, 144, 0 };
+ struct result r;
+ int i,imm;
+
+ printf("%-5s %-9s %9s %9s %9s %9s\n", "LEDs", "mode", "avg[ms]", "p95[ms]", "max[ms]", "frames");
+ for( i = 0 ; lens[i] ; i++ )
+ {
+	for( imm = 0 ; imm < 2 ; imm++ )
+	{
+		simulate( lens[i], imm, &r );
+		printf("%-5d %-9s %9.2f %9.2f %9.2f %9d\n", lens[i],
+		       (imm) ? "key" : "tick",
+		       r.avg/1000.0, r.p95/1000.0, r.max/1000.0, r.nframes );
+	}
+ }
+
+ return 0;
+}
@@ -22,6 +22,7 @@
 
 #include "startup.h"
 #include "cx_main.h"
+#include "apply.h"
 #include "version.h"
 #include "utils.h"
 
@@ -52,7 +53,12 @@ LONG Main(void)
 
  if( !res ) /* startup successful ? */
  {
-	res = cx_main( &conf );
+	if( conf.apply )
+		res = apply_main( &conf );
+	else if( conf.stripnote )
+		res = apply_note( &conf );
+	else
+		res = cx_main( &conf );
  }
 
  /* Cleanup */
@@ -0,0 +1,272 @@
+/*
+  stripbench.c
+
+  (c) 2026 Henryk Richter
+
+  Host stand-in for the Amiga side of LED strip streaming: generate
+  some animations, encode them with stripframe.c, decode them again
+  like the keyboard does (led_digital_putframe()) and estimate the
+  achievable frame rate across the keyboard link.
+
+  build: cc -O2 -o stripbench stripbench.c stripframe.c
+
+  Runs for the default strip (15 LEDs) and the longest one (144 LEDs),
+  where frames are split into several streams of max. 127 bytes.
+
+  Link model (see ciacomm.s and recv_commands() in main.c):
+   - CIA serial at ~8.25 kHz: ~970us per byte
+   - per stream: ~40ms end of stream detection on the keyboard
+     (10 x 4ms Timer0 overflows) plus ~5ms for ACK1/ACK
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stripframe.h"
+
+#define LINK_BYTE_US   970
+#define LINK_STREAM_US 45000
+#define STREAM_HDR     4 /* preamble (2), LEDCMD_EXT|LEDX_FRAME, length */
+#define STREAM_MAX     (127-2) /* frame bytes per stream (firmware: 127 incl. command and length) */
+#define NFRAMES        1000
+
+int sb_nled; /* strip length of the current run */
+
+/* reference decoder, keep in sync with led_digital_putframe() */
+unsigned char kb_frame[SF_MAXLED][3];
+unsigned char kb_pal[SF_NPAL][3];
+
+void kb_putframe( unsigned char *buf, int n )
+{
+ int op,cnt,pos;
+
+ pos = 0;
+ while( n-- > 0 )
+ {
+	op = *buf++;
+	if( op & SF_OP_RUN )
+	{
+		cnt = ((op>>4)&7)+1;
+		while( (cnt--) && (pos < sb_nled) )
+		{
+			memcpy( kb_frame[pos++], kb_pal[op&0xF], 3 );
+		}
+	}
+	else if( op & SF_OP_SKIP )
+	{
+		if( pos < sb_nled )
+			pos += (op&0x3F)+1;
+	}
+	else if( (op & 0xF0) == SF_OP_PAL )
+	{
+		if( n < 3 )
+			break;
+		n -= 3;
+		memcpy( kb_pal[op&0xF], buf, 3 );
+		buf += 3;
+	}
+	else if( op == SF_OP_RGB )
+	{
+		if( n < 3 )
+			break;
+		n -= 3;
+		if( pos < sb_nled )
+			memcpy( kb_frame[pos], buf, 3 );
+		buf += 3;
+		pos++;
+	}
+	else
+		break;
+ }
+}
+
+/* ------------------------- test animations ------------------------- */
+
+void hue( unsigned char *rgb, int h ) /* h=0...359, full saturation */
+{
+	int x = (h%60)*255/60;
+
+	switch( (h/60)%6 )
+	{
+		case 0: rgb[0]=255;   rgb[1]=x;     rgb[2]=0;     break;
+		case 1: rgb[0]=255-x; rgb[1]=255;   rgb[2]=0;     break;
+		case 2: rgb[0]=0;     rgb[1]=255;   rgb[2]=x;     break;
+		case 3: rgb[0]=0;     rgb[1]=255-x; rgb[2]=255;   break;
+		case 4: rgb[0]=x;     rgb[1]=0;     rgb[2]=255;   break;
+		default:rgb[0]=255;   rgb[1]=0;     rgb[2]=255-x; break;
+	}
+}
+
+void anim_static( unsigned char *rgb, int f )
+{
+	int i;
+
+	(void)f; /* frame number unused, same signature as the others */
+	for( i=0 ; i < sb_nled ; i++ )
+	{
+		rgb[i*3+0] = 0x20; rgb[i*3+1] = 0x40; rgb[i*3+2] = 0x80;
+	}
+}
+
+void anim_dot( unsigned char *rgb, int f ) /* moving white dot on static color */
+{
+	int p = (f/2) % (sb_nled*2-2);
+
+	anim_static( rgb, f );
+	if( p >= sb_nled )
+		p = sb_nled*2-2-p;
+	rgb[p*3+0] = rgb[p*3+1] = rgb[p*3+2] = 0xff;
+}
+
+void anim_kitt( unsigned char *rgb, int f ) /* dot with fading tail */
+{
+	static unsigned char tail[SF_MAXLED];
+	int i,p = f % (sb_nled*2-2);
+
+	if( p >= sb_nled )
+		p = sb_nled*2-2-p;
+	for( i=0 ; i < sb_nled ; i++ )
+	{
+		tail[i] = (i == p) ? 255 : (tail[i] > 60) ? tail[i]-60 : 0;
+		rgb[i*3+0] = tail[i];
+		rgb[i*3+1] = 0;
+		rgb[i*3+2] = 0;
+	}
+}
+
+void anim_vu( unsigned char *rgb, int f ) /* VU meter, 3 colors */
+{
+	static int lev;
+	int i;
+
+	(void)f;
+
+	lev += ((rand()%7)-3)*sb_nled/15;
+	lev = (lev < 0) ? 0 : (lev > sb_nled) ? sb_nled : lev;
+	for( i=0 ; i < sb_nled ; i++ )
+	{
+		unsigned char *c = &rgb[i*3];
+		if( i >= lev )      { c[0]=0;   c[1]=0;   c[2]=0; }
+		else if( i*15 < sb_nled*9 )  { c[0]=0;   c[1]=255; c[2]=0; }
+		else if( i*15 < sb_nled*13 ) { c[0]=255; c[1]=200; c[2]=0; }
+		else                { c[0]=255; c[1]=0;   c[2]=0; }
+	}
+}
+
+void anim_rainbow( unsigned char *rgb, int f ) /* scrolling rainbow, 24 hues */
+{
+	int i;
+	for( i=0 ; i < sb_nled ; i++ )
+		hue( &rgb[i*3], ((i+f)%24)*15 );
+}
+
+void anim_noise( unsigned char *rgb, int f ) /* worst case */
+{
+	int i;
+
+	(void)f;
+	for( i=0 ; i < sb_nled*3 ; i++ )
+		rgb[i] = rand();
+}
+
+struct anim {
+	const char *name;
+	void (*fn)( unsigned char *rgb, int f );
+} anims[] = {
+	{ "static",  anim_static  },
+	{ "dot",     anim_dot     },
+	{ "kitt",    anim_kitt    },
+	{ "vu",      anim_vu      },
+	{ "rainbow", anim_rainbow },
+	{ "noise",   anim_noise   },
+	{ NULL, NULL }
+};
+
+
+/* streams (and bytes) needed for one uncompressed frame */
+static int raw_streams( int nled, int *bytes )
+{
+	int n = nled*3; /* R,G,B per pixel */
+
+	*bytes = n;
+	return (n + STREAM_MAX-1) / STREAM_MAX;
+}
+
+int main( void )
+{
+ static const int lengths[] = { SF_NLED, SF_MAXLED, 0 };
+ struct stripframe_state st;
+ unsigned char rgb[SF_MAXLED*3];
+ unsigned char buf[STREAM_MAX];
+ struct anim *a;
+ int f,l,n,nraw,nbytes,nsent,nstreams,maxn;
+ long total;
+ double rawus,encus;
+
+ for( l=0 ; lengths[l] ; l++ )
+ {
+  sb_nled = lengths[l];
+  srand( 1 );
+
+  /* reference: uncompressed frame, 3 bytes per pixel */
+  nraw  = raw_streams( sb_nled, &nbytes );
+  rawus = 1e6 / (double)( nraw*(LINK_STREAM_US + STREAM_HDR*LINK_BYTE_US) + nbytes*LINK_BYTE_US );
+
+  printf("%d LEDs, uncompressed frame: %d bytes in %d stream(s), %.1f fps\n\n", sb_nled, nbytes, nraw, rawus );
+  printf("%-8s %9s %9s %9s %9s %9s\n", "anim", "bytes/frm", "max", "sent", "streams", "fps");
+
+  for( a = anims ; a->name ; a++ )
+  {
+	memset( &st, 0, sizeof(st) );
+	stripframe_setlength( &st, sb_nled );
+	memset( kb_frame, 0, sizeof(kb_frame) );
+	total    = 0;
+	nsent    = 0;
+	nstreams = 0;
+	maxn     = 0;
+
+	for( f=0 ; f < NFRAMES ; f++ )
+	{
+		int frame = 0; /* bytes of this frame, all streams */
+
+		a->fn( rgb, f );
+		do
+		{
+			n = stripframe_encode( &st, buf, STREAM_MAX, rgb );
+			if( n > STREAM_MAX )
+			{
+				printf("%s: frame %d exceeds stream (%d)\n", a->name, f, n );
+				return 1;
+			}
+			kb_putframe( buf, n );
+			if( n > 0 )
+				nstreams++;
+			frame += n;
+		}
+		while( st.pending );
+
+		if( memcmp( kb_frame, rgb, sb_nled*3 ) )
+		{
+			printf("%s: frame %d decodes wrong\n", a->name, f );
+			return 1;
+		}
+		if( frame > 0 )
+		{
+			nsent++;
+			total += frame;
+		}
+		if( frame > maxn )
+			maxn = frame;
+	}
+
+	/* time for all sent streams, unchanged frames cost nothing */
+	encus = (double)nstreams*(LINK_STREAM_US+STREAM_HDR*LINK_BYTE_US) + (double)total*LINK_BYTE_US;
+	printf("%-8s %9.1f %9d %9d %9d %9.1f\n", a->name,
+	       (nsent) ? (double)total/nsent : 0.0, maxn, nsent, nstreams,
+	       (nsent) ? 1e6*nsent/encus : 0.0 );
+  }
+  printf("\n");
+ }
+
+ return 0;
+}
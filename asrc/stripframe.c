@@ -0,0 +1,161 @@
+/*
+  stripframe.c
+
+  (C)2026 Henryk Richter <henryk.richter@gmx.net>
+
+  purpose:
+   Encoder for LED strip frames. The keyboard keeps the last frame
+   and a 16 entry palette, hence a frame consists of
+
+    - skips for unchanged pixels (delta to last frame)
+    - runs of palette colors (1-8 pixels per byte)
+    - palette definitions for colors used more than once or
+      already present in the last frame (moving content)
+    - direct colors for the rest
+
+   Trailing unchanged pixels are not sent at all. A frame that does
+   not fit into one transfer (long strips) is sent in pieces: the
+   keyboard state is tracked per pixel prefix, so the next piece
+   skips what already went out.
+
+*/
+#include "stripframe.h"
+
+#define SF_SAME( _a_, _b_ ) ( ((_a_)[0]==(_b_)[0]) && ((_a_)[1]==(_b_)[1]) && ((_a_)[2]==(_b_)[2]) )
+
+void stripframe_reset( struct stripframe_state *st )
+{
+	st->palvalid = 0;
+	st->nextpal  = 0;
+	st->known    = 0;
+	st->pending  = 0;
+}
+
+
+void stripframe_setlength( struct stripframe_state *st, int nled )
+{
+	if( nled < 1 )
+		nled = 1;
+	if( nled > SF_MAXLED )
+		nled = SF_MAXLED;
+	if( st->nled != nled )
+		stripframe_reset( st );
+	st->nled = (unsigned char)nled;
+}
+
+
+int stripframe_encode( struct stripframe_state *st, unsigned char *dst, int max, const unsigned char *rgb )
+{
+	unsigned char *d = dst;
+	unsigned short used = 0; /* palette entries referenced in this frame */
+	int i,j,k,n,end;
+
+	/* last changed pixel + 1 */
+	end = st->nled;
+	while( (end > 0) && (end <= st->known) && SF_SAME( &rgb[(end-1)*3], st->last[end-1] ) )
+		end--;
+
+	st->pending = 0;
+	i = 0;
+	while( i < end )
+	{
+		const unsigned char *c = &rgb[i*3];
+
+		if( (d - dst) + SF_MAXSTEP > max )
+		{
+			st->pending = 1; /* rest with the next call */
+			break;
+		}
+
+		/* unchanged pixels */
+		if( (i < st->known) && SF_SAME( c, st->last[i] ) )
+		{
+			n = 1;
+			while( (i+n < end) && (i+n < st->known) && (n < SF_MAXSKIP) && SF_SAME( &rgb[(i+n)*3], st->last[i+n] ) )
+				n++;
+			*d++ = SF_OP_SKIP | (n-1);
+			i += n;
+			continue;
+		}
+
+		/* palette lookup */
+		for( k=0 ; k < SF_NPAL ; k++ )
+		{
+			if( (st->palvalid & (1<<k)) && SF_SAME( c, st->pal[k] ) )
+				break;
+		}
+
+		if( k == SF_NPAL )
+		{
+			/* new color: palette entry only pays off when used again,
+			   either in this frame or (moving content) in the next ones */
+			for( j=i+1, n=0 ; j < end ; j++ )
+			{
+				if( SF_SAME( c, &rgb[j*3] ) )
+					n++;
+			}
+			for( j=0 ; (j < st->known) && (!n) ; j++ )
+			{
+				if( SF_SAME( c, st->last[j] ) )
+					n++;
+			}
+			if( n > 0 )
+			{
+				/* free slot or round robin, but not one used in this frame */
+				for( k=0 ; k < SF_NPAL ; k++ )
+				{
+					if( !(st->palvalid & (1<<k)) )
+						break;
+				}
+				if( k == SF_NPAL )
+				{
+					for( j=0 ; j < SF_NPAL ; j++ )
+					{
+						k = st->nextpal;
+						st->nextpal = (st->nextpal+1) & (SF_NPAL-1);
+						if( !(used & (1<<k)) )
+							break;
+					}
+					if( used & (1<<k) )
+						k = SF_NPAL; /* palette full with current colors */
+				}
+			}
+			if( k == SF_NPAL )
+			{
+				*d++ = SF_OP_RGB;
+				*d++ = c[0];
+				*d++ = c[1];
+				*d++ = c[2];
+				i++;
+				continue;
+			}
+			*d++ = SF_OP_PAL | k;
+			*d++ = st->pal[k][0] = c[0];
+			*d++ = st->pal[k][1] = c[1];
+			*d++ = st->pal[k][2] = c[2];
+			st->palvalid |= (1<<k);
+		}
+		used |= (1<<k);
+
+		/* run of palette color */
+		n = 1;
+		while( (i+n < end) && (n < SF_MAXRUN) && SF_SAME( c, &rgb[(i+n)*3] ) )
+			n++;
+		*d++ = SF_OP_RUN | ((n-1)<<4) | k;
+		i += n;
+	}
+
+	/* pixels the keyboard has now (all of them when done) */
+	if( !st->pending )
+		i = st->nled;
+	for( j=0 ; j < i ; j++ )
+	{
+		st->last[j][0] = rgb[j*3+0];
+		st->last[j][1] = rgb[j*3+1];
+		st->last[j][2] = rgb[j*3+2];
+	}
+	if( i > st->known )
+		st->known = (unsigned char)i;
+
+	return (int)(d - dst);
+}
@@ -0,0 +1,56 @@
+/*
+  stripframe.h
+
+  (C)2026 Henryk Richter <henryk.richter@gmx.net>
+
+  purpose:
+   encoder for LED strip frames (LEDCMD_EXT+LEDX_FRAME),
+   plain C to allow for host builds (see stripbench.c)
+
+*/
+#ifndef _INC_STRIPFRAME_H
+#define _INC_STRIPFRAME_H
+
+/* number of pixels (default, max. = LEDX_MAXSTRIP), palette size */
+#define SF_NLED    15
+#define SF_MAXLED  144
+#define SF_NPAL    16
+
+/* frame opcodes (keep in sync with src/led_digital.h) */
+#define SF_OP_RUN  0x80 /* 1lllpppp: l+1 pixels of palette color p  */
+#define SF_OP_SKIP 0x40 /* 01ssssss: skip s+1 pixels (unchanged)     */
+#define SF_OP_PAL  0x20 /* 0010pppp R,G,B: define palette color p    */
+#define SF_OP_RGB  0x01 /* R,G,B: one pixel, direct color            */
+#define SF_OP_OFF  0x00 /* end streaming, back to built-in effects   */
+
+#define SF_MAXRUN  8
+#define SF_MAXSKIP 64
+
+/* worst case: palette definition + run per pixel */
+#define SF_MAXFRAME (SF_MAXLED*5)
+/* bytes one pixel may take (palette definition + run) */
+#define SF_MAXSTEP  5
+
+/* mirror of the keyboard side: last frame and palette */
+struct stripframe_state {
+	unsigned char  last[SF_MAXLED][3];
+	unsigned char  pal[SF_NPAL][3];
+	unsigned short palvalid;  /* bit n: pal[n] known on keyboard */
+	unsigned char  nextpal;   /* round robin replacement */
+	unsigned char  nled;      /* strip length */
+	unsigned char  known;     /* last[0...known-1] known on keyboard */
+	unsigned char  pending;   /* frame did not fit: call encode again */
+};
+
+/* forget keyboard state (initially and after failed transfers) */
+void stripframe_reset( struct stripframe_state *st );
+/* strip length 1...SF_MAXLED, forgets keyboard state on change */
+void stripframe_setlength( struct stripframe_state *st, int nled );
+
+/* encode rgb[nled*3] into dst, at most max bytes (>= SF_MAXSTEP),
+   returns number of bytes (0 = frame unchanged); when the frame
+   does not fit, st->pending is set and the next call with the same
+   rgb encodes the rest (skipping the pixels sent before) */
+int  stripframe_encode( struct stripframe_state *st, unsigned char *dst, int max, const unsigned char *rgb );
+
+#endif /* _INC_STRIPFRAME_H */
@@ -0,0 +1,529 @@
+/*
+  stripvm.c
+
+  (c) 2026 Henryk Richter
+
+  Assembler and simulator for LED strip effect programs (strip mode 7,
+  LEDCMD_EXT+LEDX_SETPROG). Assembles a source file into bytecode,
+  checks it like the keyboard does, runs it for all 256 values of the
+  frame counter and reports the instructions per frame against the
+  frame budget of the firmware.
+
+  build: cc -O2 -o stripvm stripvm.c
+
+  usage: stripvm [-n pixels] [-c RRGGBB] [-o file] [-p frames] source
+
+   -n  canvas length (strip + 7 analog LEDs in LEDM_CANVAS), default 15
+   -c  strip color (registers CR,CG,CB), default 204080
+   -o  write bytecode (for A500KBConfig STRIPPROG=file)
+   -p  print the pixels of the first frames
+
+  returns 0 if the program fits the budget, 5 if frames get cut, 10
+  on errors
+
+  Source: one instruction per line, ';' starts a comment, "label:"
+  marks a jump target (jumps go forward only)
+
+   ldi  d,imm   mov d,s   add d,s   adds d,s  sub d,s   subs d,s
+   mul  d,s     addi d,imm          muli d,imm          shl d,imm
+   shr  d,imm   tri d,s   hue d,s   sklt d,s  skeq d,s
+   jmp  label   end
+
+  registers: i n t cr cg cb x0...x6 r g b (see src/led_digital.h)
+
+  example, rainbow moving along the canvas:
+
+	mov  x0,i
+	shl  x0,4       ; 16 hue steps per pixel
+	add  x0,t
+	ldi  x1,255
+	hue  x1,x0      ; r,g,b = wheel(x0) at full value
+	end
+
+  Timing model (AVR at 16 MHz, estimates from the interpreter loop in
+  LED_vm_pixel()): ~60 cycles per pixel, ~35 cycles per instruction,
+  HUE ~110 cycles.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+/* keep in sync with src/led_digital.h */
+#define PROGMAX   96
+#define VMBUDGET  2048
+#define SLICE     48   /* LEDD_SLICE_VM in led_digital.c */
+#define NCANVAS   (7+144)
+
+#define VM_LDI  0x0
+#define VM_MOV  0x1
+#define VM_ADD  0x2
+#define VM_ADDS 0x3
+#define VM_SUB  0x4
+#define VM_SUBS 0x5
+#define VM_MUL  0x6
+#define VM_ADDI 0x7
+#define VM_MULI 0x8
+#define VM_SHL  0x9
+#define VM_SHR  0xA
+#define VM_TRI  0xB
+#define VM_HUE  0xC
+#define VM_SKLT 0xD
+#define VM_SKEQ 0xE
+#define VM_JMP  0xF
+
+#define VR_I  0
+#define VR_N  1
+#define VR_T  2
+#define VR_CR 3
+#define VR_X0 6
+#define VR_R  13
+
+#define CYC_PIXEL 60
+#define CYC_INSN  35
+#define CYC_HUE   110
+#define CPU_MHZ   16
+
+/* operand kinds */
+#define K_NONE 0
+#define K_REG  1 /* d,s   */
+#define K_IMM  2 /* d,imm */
+#define K_JMP  3 /* label */
+
+struct mnemonic {
+	const char *name;
+	int op;
+	int kind;
+} mnemonics[] = {
+	{ "ldi",  VM_LDI,  K_IMM },
+	{ "mov",  VM_MOV,  K_REG },
+	{ "add",  VM_ADD,  K_REG },
+	{ "adds", VM_ADDS, K_REG },
+	{ "sub",  VM_SUB,  K_REG },
+	{ "subs", VM_SUBS, K_REG },
+	{ "mul",  VM_MUL,  K_REG },
+	{ "addi", VM_ADDI, K_IMM },
+	{ "muli", VM_MULI, K_IMM },
+	{ "shl",  VM_SHL,  K_IMM },
+	{ "shr",  VM_SHR,  K_IMM },
+	{ "tri",  VM_TRI,  K_REG },
+	{ "hue",  VM_HUE,  K_REG },
+	{ "sklt", VM_SKLT, K_REG },
+	{ "skeq", VM_SKEQ, K_REG },
+	{ "jmp",  VM_JMP,  K_JMP },
+	{ "end",  VM_JMP,  K_NONE },
+	{ NULL, 0, 0 }
+};
+
+const char *regnames[16] = {
+	"i", "n", "t", "cr", "cg", "cb",
+	"x0", "x1", "x2", "x3", "x4", "x5", "x6",
+	"r", "g", "b"
+};
+
+#define MAXLABEL 64
+struct label {
+	char name[32];
+	int  insn;
+} labels[MAXLABEL];
+int nlabels;
+
+unsigned char prog[PROGMAX];
+int proglen;
+
+/* --------------------------- assembler ---------------------------- */
+
+int errors;
+
+void asm_error( int line, const char *msg, const char *arg )
+{
+	fprintf( stderr, "line %d: %s%s%s\n", line, msg, (arg) ? " " : "", (arg) ? arg : "" );
+	errors++;
+}
+
+char *skipws( char *s )
+{
+	while( *s && isspace( (unsigned char)*s ) )
+		s++;
+	return s;
+}
+
+/* next token up to whitespace or ',' */
+char *token( char **s, char *buf, int n )
+{
+	char *p = skipws( *s );
+	int i = 0;
+
+	while( *p && !isspace( (unsigned char)*p ) && (*p != ',') )
+	{
+		if( i < n-1 )
+			buf[i++] = tolower( (unsigned char)*p );
+		p++;
+	}
+	buf[i] = 0;
+	p = skipws( p );
+	if( *p == ',' )
+		p++;
+	*s = p;
+
+	return (i) ? buf : NULL;
+}
+
+int parse_reg( const char *s )
+{
+	int r;
+
+	for( r = 0 ; r < 16 ; r++ )
+	{
+		if( !strcmp( s, regnames[r] ) )
+			return r;
+	}
+	return -1;
+}
+
+int parse_imm( const char *s, int *v )
+{
+	char *e;
+	long l = strtol( s, &e, 0 );
+
+	if( *e || (l < 0) || (l > 255) )
+		return 0;
+	*v = (int)l;
+	return 1;
+}
+
+int find_label( const char *s )
+{
+	int i;
+
+	for( i = 0 ; i < nlabels ; i++ )
+	{
+		if( !strcmp( labels[i].name, s ) )
+			return labels[i].insn;
+	}
+	return -1;
+}
+
+/* pass 0: labels only, pass 1: code */
+int assemble( FILE *f, int pass )
+{
+	char line[256],tok[32],*s,*c;
+	struct mnemonic *m;
+	int ln,insn,d,a,t;
+
+	rewind( f );
+	ln   = 0;
+	insn = 0;
+	while( fgets( line, sizeof(line), f ) )
+	{
+		ln++;
+		if( (c = strchr( line, ';' )) )
+			*c = 0;
+		s = skipws( line );
+
+		/* label */
+		if( (c = strchr( s, ':' )) )
+		{
+			*c = 0;
+			if( (pass == 0) && (nlabels < MAXLABEL) )
+			{
+				token( &s, labels[nlabels].name, sizeof(labels[0].name) );
+				labels[nlabels++].insn = insn;
+			}
+			s = c+1;
+		}
+
+		if( !token( &s, tok, sizeof(tok) ) )
+			continue;
+		for( m = mnemonics ; m->name ; m++ )
+		{
+			if( !strcmp( m->name, tok ) )
+				break;
+		}
+		if( !m->name )
+		{
+			if( pass )
+				asm_error( ln, "unknown instruction", tok );
+			continue;
+		}
+
+		d = 0;
+		a = 0;
+		if( pass )
+		{
+			if( (m->kind == K_REG) || (m->kind == K_IMM) )
+			{
+				if( !token( &s, tok, sizeof(tok) ) || ((d = parse_reg( tok )) < 0) )
+					asm_error( ln, "destination register expected", NULL );
+				if( !token( &s, tok, sizeof(tok) ) )
+					asm_error( ln, "operand expected", NULL );
+				else if( m->kind == K_REG )
+				{
+					if( (a = parse_reg( tok )) < 0 )
+						asm_error( ln, "source register expected:", tok );
+				}
+				else if( !parse_imm( tok, &a ) )
+					asm_error( ln, "immediate 0...255 expected:", tok );
+				if( ((m->op == VM_SHL) || (m->op == VM_SHR)) && (a > 7) )
+					asm_error( ln, "shift count 0...7 expected", NULL );
+			}
+			else if( m->kind == K_JMP )
+			{
+				if( !token( &s, tok, sizeof(tok) ) || ((t = find_label( tok )) < 0) )
+					asm_error( ln, "unknown label", tok );
+				else if( t <= insn )
+					asm_error( ln, "jumps go forward only:", tok );
+				else	a = t - insn - 1;
+			}
+			else	a = 0xFF; /* end */
+			if( token( &s, tok, sizeof(tok) ) )
+				asm_error( ln, "extra operand", tok );
+
+			if( insn*2+2 > PROGMAX )
+			{
+				asm_error( ln, "program too long", NULL );
+				return -1;
+			}
+			prog[insn*2]   = (m->op<<4) | d;
+			prog[insn*2+1] = a;
+		}
+		insn++;
+	}
+
+	return insn*2;
+}
+
+/* same check as led_digital_setprog() */
+int check( unsigned char *buf, int n )
+{
+	int pc;
+
+	if( (n & 1) || (n > PROGMAX) )
+		return 0;
+	for( pc = 0 ; pc < n ; pc += 2 )
+	{
+		if( ((buf[pc]>>4) == VM_JMP) && (buf[pc+1] != 0xFF) &&
+		    ( pc + 2 + (buf[pc+1]<<1) > n ) )
+			return 0;
+	}
+	return 1;
+}
+
+/* ---------------------------- simulator --------------------------- */
+
+/* reference interpreter, keep in sync with LED_vm_pixel() */
+void vm_hue( unsigned char *out, unsigned char h, unsigned char v )
+{
+	unsigned int t = h * 6;
+	unsigned char up = t & 0xFF, dn = 255 - up;
+	unsigned char r,g,b;
+
+	switch( t >> 8 )
+	{
+		case 0:  r = 255; g = up;  b = 0;   break;
+		case 1:  r = dn;  g = 255; b = 0;   break;
+		case 2:  r = 0;   g = 255; b = up;  break;
+		case 3:  r = 0;   g = dn;  b = 255; break;
+		case 4:  r = up;  g = 0;   b = 255; break;
+		default: r = 255; g = 0;   b = dn;  break;
+	}
+	out[0] = ( r * (v+1) )>>8;
+	out[1] = ( g * (v+1) )>>8;
+	out[2] = ( b * (v+1) )>>8;
+}
+
+int vm_pixel( unsigned char *out, int i, int n, int frame, unsigned char *col, long *cycles )
+{
+	unsigned char reg[16],d,a,s;
+	unsigned int v;
+	int pc,cnt;
+
+	memset( reg, 0, sizeof(reg) );
+	reg[VR_I]    = i;
+	reg[VR_N]    = n;
+	reg[VR_T]    = frame;
+	reg[VR_CR]   = col[0];
+	reg[VR_CR+1] = col[1];
+	reg[VR_CR+2] = col[2];
+	*cycles += CYC_PIXEL;
+
+	for( pc = 0, cnt = 0 ; pc < proglen ; pc += 2, cnt++ )
+	{
+		d = prog[pc] & 0xF;
+		a = prog[pc+1];
+		s = reg[a & 0xF];
+		*cycles += CYC_INSN;
+		switch( prog[pc] >> 4 )
+		{
+			case VM_LDI:  reg[d] = a; break;
+			case VM_MOV:  reg[d] = s; break;
+			case VM_ADD:  reg[d] += s; break;
+			case VM_ADDS: v = reg[d] + s; reg[d] = ( v > 255 ) ? 255 : v; break;
+			case VM_SUB:  reg[d] -= s; break;
+			case VM_SUBS: reg[d] = ( reg[d] > s ) ? reg[d] - s : 0; break;
+			case VM_MUL:  reg[d] = ( reg[d] * (s+1) )>>8; break;
+			case VM_ADDI: reg[d] += a; break;
+			case VM_MULI: reg[d] = ( reg[d] * (a+1) )>>8; break;
+			case VM_SHL:  reg[d] <<= (a & 7); break;
+			case VM_SHR:  reg[d] >>= (a & 7); break;
+			case VM_TRI:  reg[d] = ( s & 0x80 ) ? (255-s)<<1 : s<<1; break;
+			case VM_HUE:  vm_hue( &reg[VR_R], s, reg[d] ); *cycles += CYC_HUE-CYC_INSN; break;
+			case VM_SKLT: if( reg[d] <  s ) pc += 2; break;
+			case VM_SKEQ: if( reg[d] == s ) pc += 2; break;
+			default:
+				if( a == 0xFF )
+					pc = proglen;
+				else	pc += a<<1;
+				break;
+		}
+	}
+
+	out[0] = reg[VR_R];
+	out[1] = reg[VR_R+1];
+	out[2] = reg[VR_R+2];
+
+	return cnt;
+}
+
+
+int main( int argc, char **argv )
+{
+	unsigned char col[3] = { 0x20, 0x40, 0x80 };
+	unsigned char pix[NCANVAS][3];
+	const char *src = NULL, *out = NULL;
+	int n = 15, nprint = 0;
+	int i,f,k,ninsn,worst,cut,slice,nslice,maxslice;
+	long insn,maxinsn,sum,cycles,maxcyc,scyc,maxscyc,c0;
+	unsigned long c;
+	FILE *fh;
+
+	for( i = 1 ; i < argc ; i++ )
+	{
+		if( !strcmp( argv[i], "-n" ) && (i+1 < argc) )
+			n = atoi( argv[++i] );
+		else if( !strcmp( argv[i], "-c" ) && (i+1 < argc) )
+		{
+			c = strtoul( argv[++i], NULL, 16 );
+			col[0] = c>>16;
+			col[1] = c>>8;
+			col[2] = c;
+		}
+		else if( !strcmp( argv[i], "-o" ) && (i+1 < argc) )
+			out = argv[++i];
+		else if( !strcmp( argv[i], "-p" ) && (i+1 < argc) )
+			nprint = atoi( argv[++i] );
+		else if( argv[i][0] != '-' )
+			src = argv[i];
+		else
+			src = NULL, i = argc;
+	}
+	if( !src || (n < 1) || (n > NCANVAS) )
+	{
+		fprintf( stderr, "usage: %s [-n pixels] [-c RRGGBB] [-o file] [-p frames] source\n", argv[0] );
+		return 10;
+	}
+
+	if( !(fh = fopen( src, "r" )) )
+	{
+		fprintf( stderr, "cannot open %s\n", src );
+		return 10;
+	}
+	assemble( fh, 0 );
+	proglen = assemble( fh, 1 );
+	fclose( fh );
+	if( errors || (proglen < 0) )
+		return 10;
+	if( !check( prog, proglen ) )
+	{
+		fprintf( stderr, "program rejected by keyboard check\n" );
+		return 10;
+	}
+
+	ninsn = proglen/2;
+	printf("%d bytes, %d instructions\n", proglen, ninsn );
+	for( i = 0 ; i < proglen ; i++ )
+		printf("%02x%s", prog[i], ((i & 15) == 15) ? "\n" : " " );
+	if( proglen & 15 )
+		printf("\n");
+
+	/* all frame counter values */
+	maxinsn = 0;
+	maxcyc  = 0;
+	maxslice = 0;
+	maxscyc  = 0;
+	sum     = 0;
+	cut     = 0;
+	for( f = 0 ; f < 256 ; f++ )
+	{
+		long left = VMBUDGET;
+
+		insn   = 0;
+		cycles = 0;
+		slice  = 0;
+		nslice = 1;
+		scyc   = 0;
+		for( i = 0 ; i < n ; i++ )
+		{
+			if( left < ninsn ) /* like the keyboard: rest keeps last color */
+			{
+				cut++;
+				break;
+			}
+			if( slice + ninsn > SLICE ) /* longest path no longer fits: next led_digital_poll() */
+			{
+				slice = 0;
+				scyc  = 0;
+				nslice++;
+			}
+			c0 = cycles;
+			k = vm_pixel( pix[i], i, n, f, col, &cycles );
+			insn  += k;
+			left  -= k;
+			slice += k;
+			scyc  += cycles - c0;
+			if( scyc > maxscyc )
+				maxscyc = scyc;
+		}
+		if( nslice > maxslice )
+			maxslice = nslice;
+		if( insn > maxinsn )
+			maxinsn = insn;
+		if( cycles > maxcyc )
+			maxcyc = cycles;
+		sum += insn;
+
+		if( f < nprint )
+		{
+			printf("frame %3d:", f );
+			for( i = 0 ; i < n ; i++ )
+				printf(" %02x%02x%02x", pix[i][0], pix[i][1], pix[i][2] );
+			printf("\n");
+		}
+	}
+
+	worst = ninsn * n;
+	printf("canvas %d pixels, budget %d instructions/frame\n", n, VMBUDGET );
+	printf("worst case (all paths): %d instructions/frame\n", worst );
+	printf("simulated: max %ld, avg %.1f instructions/frame\n", maxinsn, (double)sum/256 );
+	printf("estimated: max %.2f ms/frame (%ld cycles) in %d main loop passes of max %ld us\n",
+	       (double)maxcyc/(CPU_MHZ*1000), maxcyc, maxslice, maxscyc/CPU_MHZ );
+
+	if( out )
+	{
+		if( !(fh = fopen( out, "wb" )) || (fwrite( prog, 1, proglen, fh ) != (size_t)proglen) )
+		{
+			fprintf( stderr, "cannot write %s\n", out );
+			return 10;
+		}
+		fclose( fh );
+	}
+
+	if( cut )
+	{
+		printf("over budget: %d of 256 frames cut short\n", cut );
+		return 5;
+	}
+	printf("fits: %s\n", (worst <= VMBUDGET) ? "always" : "for the simulated colors" );
+
+	return 0;
+}
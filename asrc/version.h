@@ -10,9 +10,9 @@
 
 #define PROGNAME "A500KBConfig"
 #define LIBVERSION  "1"
-#define LIBREVISION "9"
+#define LIBREVISION "10"
 /* #define DEVICEEXTRA Beta */
-#define LIBDATE     "28.3.25"
+#define LIBDATE     "19.10.26"
 
 #endif
 
@@ -0,0 +1,286 @@
+/*
+  vsrc.c
+
+  (C)2026 Henryk Richter <henryk.richter@gmx.net>
+
+  purpose:
+   Activity monitor for the virtual LED sources. Each of the two
+   sources is driven by either
+
+    CPU         - load measured by an idle counter at lowest priority
+    <device>    - read/write requests passed to the BeginIO vector
+                  of an exec device (e.g. trackdisk.device, scsi.device
+                  or a SANA-II network driver)
+
+   The state is polled by the commodity timer, the keyboard only gets
+   a command when the state changes (see ledmanager_setVSrc()).
+
+*/
+#include <exec/types.h>
+#include <exec/execbase.h>
+#include <exec/memory.h>
+#include <exec/io.h>
+#include <exec/devices.h>
+#include <devices/trackdisk.h>
+#include <dos/dostags.h>
+#include <string.h>
+
+#define __NOLIBBASE__
+#include <proto/exec.h>
+#include <proto/dos.h>
+#include <proto/utility.h>
+
+#include "compiler.h"
+#include "vsrc.h"
+#include "cx_main.h"
+
+/* external lib bases */
+extern struct Library *UtilityBase;
+
+#ifndef HD_SCSICMD
+#define HD_SCSICMD 28 /* devices/scsidisk.h */
+#endif
+#ifndef TD_READ64
+#define TD_READ64  24 /* TD64 */
+#define TD_WRITE64 25
+#endif
+#ifndef NSCMD_TD_READ64
+#define NSCMD_TD_READ64  0xC000 /* devices/newstyle.h */
+#define NSCMD_TD_WRITE64 0xC001
+#endif
+
+#define VSRCT_NONE 0
+#define VSRCT_CPU  1
+#define VSRCT_DEV  2
+
+typedef ASM void (*vsrc_BeginIOFunc)( ASMR(a1) struct IORequest *io ASMREG(a1),
+                                      ASMR(a6) struct Device    *dev ASMREG(a6) );
+
+struct vsrc_Source {
+	struct Device    *dev;        /* patched device */
+	vsrc_BeginIOFunc  oldBeginIO;
+	APTR              newBeginIO;
+	volatile ULONG    count;      /* I/O requests, incremented by patch */
+	ULONG             lastcount;
+	UBYTE             type;       /* VSRCT_ */
+};
+
+struct vsrc_Source vsrc[VSRC_N];
+
+/* CPU load */
+volatile ULONG vsrc_idlecount;
+volatile UBYTE vsrc_idlequit;
+ULONG          vsrc_lastidle;
+ULONG          vsrc_maxidle;  /* calibrated: highest idle count per tick */
+struct Task   *vsrc_parent;
+BYTE           vsrc_idlesig = -1;
+struct Process *vsrc_idleproc;
+
+ASM SAVEDS void vsrc_BeginIO0( ASMR(a1) struct IORequest *io ASMREG(a1), ASMR(a6) struct Device *dev ASMREG(a6) );
+ASM SAVEDS void vsrc_BeginIO1( ASMR(a1) struct IORequest *io ASMREG(a1), ASMR(a6) struct Device *dev ASMREG(a6) );
+SAVEDS void vsrc_IdleProc( void );
+LONG vsrc_patch( struct vsrc_Source *src, STRPTR devname );
+LONG vsrc_unpatch( struct vsrc_Source *src );
+
+
+LONG vsrc_init( struct configvars *conf )
+{
+	STRPTR names[VSRC_N];
+	LONG   i,ret = 0;
+
+	names[0] = (STRPTR)conf->vsrc1;
+	names[1] = (STRPTR)conf->vsrc2;
+	vsrc[0].newBeginIO = (APTR)vsrc_BeginIO0;
+	vsrc[1].newBeginIO = (APTR)vsrc_BeginIO1;
+
+	for( i=0 ; i < VSRC_N ; i++ )
+	{
+		vsrc[i].type = VSRCT_NONE;
+		if( !names[i] )
+			continue;
+
+		if( 0 == Stricmp( names[i], (STRPTR)"CPU" ) )
+		{
+			if( !vsrc_idleproc )
+			{
+				vsrc_parent  = FindTask(NULL);
+				vsrc_idlesig = AllocSignal( -1 );
+				if( vsrc_idlesig < 0 )
+					continue;
+				vsrc_idlequit  = 0;
+				vsrc_idlecount = 0;
+				vsrc_lastidle  = 0;
+				vsrc_maxidle   = 0;
+				vsrc_idleproc  = CreateNewProcTags( NP_Entry, (ULONG)vsrc_IdleProc,
+				                                    NP_Name, (ULONG)"A500KB idle",
+				                                    NP_Priority, -127,
+				                                    NP_StackSize, 2048,
+				                                    TAG_DONE );
+				if( !vsrc_idleproc )
+				{
+					FreeSignal( vsrc_idlesig );
+					vsrc_idlesig = -1;
+					continue;
+				}
+			}
+			vsrc[i].type = VSRCT_CPU;
+			ret++;
+		}
+		else
+		{
+			if( !vsrc_patch( &vsrc[i], names[i] ) )
+				ret++;
+		}
+	}
+
+	return ret;
+}
+
+
+ULONG vsrc_poll( void )
+{
+	ULONG ret = 0;
+	ULONG cnt,busy = 0;
+	LONG  i;
+
+	/* CPU: idle loops in the last tick vs. idle loops on an unloaded system */
+	if( vsrc_idleproc )
+	{
+		cnt = vsrc_idlecount;
+		busy = cnt - vsrc_lastidle;
+		vsrc_lastidle = cnt;
+		if( busy > vsrc_maxidle )
+			vsrc_maxidle = busy;
+		busy = ( busy < (vsrc_maxidle/100)*(100-VSRC_CPUBUSY) ) ? 1 : 0;
+	}
+
+	for( i=0 ; i < VSRC_N ; i++ )
+	{
+		switch( vsrc[i].type )
+		{
+			case VSRCT_CPU:
+				if( busy )
+					ret |= (1<<i);
+				break;
+			case VSRCT_DEV:
+				cnt = vsrc[i].count;
+				if( cnt != vsrc[i].lastcount )
+					ret |= (1<<i);
+				vsrc[i].lastcount = cnt;
+				break;
+			default:
+				break;
+		}
+	}
+
+	return ret;
+}
+
+
+void vsrc_exit( void )
+{
+	LONG i;
+
+	/* reverse order: both sources may have patched the same device */
+	for( i=VSRC_N-1 ; i >= 0 ; i-- )
+	{
+		if( vsrc[i].type == VSRCT_DEV )
+		{
+			/* somebody else patched on top of us: wait until they're gone */
+			while( vsrc_unpatch( &vsrc[i] ) )
+				Delay( 50 );
+		}
+		vsrc[i].type = VSRCT_NONE;
+	}
+
+	if( vsrc_idleproc )
+	{
+		vsrc_idlequit = 1;
+		Wait( 1<<vsrc_idlesig );
+		vsrc_idleproc = NULL;
+	}
+	if( vsrc_idlesig >= 0 )
+	{
+		FreeSignal( vsrc_idlesig );
+		vsrc_idlesig = -1;
+	}
+}
+
+
+/* patch BeginIO of a device that is currently in memory */
+LONG vsrc_patch( struct vsrc_Source *src, STRPTR devname )
+{
+	struct Device *dev;
+
+	Forbid();
+	dev = (struct Device*)FindName( &((struct ExecBase*)SysBase)->DeviceList, devname );
+	if( !dev )
+	{
+		Permit();
+		return -1;
+	}
+	/* keep device in memory while we're patched */
+	dev->dd_Library.lib_OpenCnt++;
+
+	src->count      = 0;
+	src->lastcount  = 0;
+	src->dev        = dev;
+	src->oldBeginIO = (vsrc_BeginIOFunc)SetFunction( (struct Library*)dev, DEV_BEGINIO, src->newBeginIO );
+	src->type       = VSRCT_DEV;
+	Permit();
+
+	return 0;
+}
+
+
+/* returns 0 on success */
+LONG vsrc_unpatch( struct vsrc_Source *src )
+{
+	APTR cur;
+
+	Forbid();
+	cur = SetFunction( (struct Library*)src->dev, DEV_BEGINIO, (APTR)src->oldBeginIO );
+	if( cur != src->newBeginIO )
+	{
+		SetFunction( (struct Library*)src->dev, DEV_BEGINIO, cur );
+		Permit();
+		return -1;
+	}
+	src->dev->dd_Library.lib_OpenCnt--;
+	Permit();
+
+	return 0;
+}
+
+
+/* count transfers only, not the media change polling etc. */
+#define VSRC_ISXFER( _cmd_ ) ( ((_cmd_) == CMD_READ)  || ((_cmd_) == CMD_WRITE) || \
+                               ((_cmd_) == TD_FORMAT) || ((_cmd_) == HD_SCSICMD) || \
+                               ((_cmd_) == TD_READ64) || ((_cmd_) == TD_WRITE64) || \
+                               ((_cmd_) == NSCMD_TD_READ64) || ((_cmd_) == NSCMD_TD_WRITE64) )
+
+ASM SAVEDS void vsrc_BeginIO0( ASMR(a1) struct IORequest *io ASMREG(a1), ASMR(a6) struct Device *dev ASMREG(a6) )
+{
+	if( VSRC_ISXFER( io->io_Command ) )
+		vsrc[0].count++;
+	vsrc[0].oldBeginIO( io, dev );
+}
+
+ASM SAVEDS void vsrc_BeginIO1( ASMR(a1) struct IORequest *io ASMREG(a1), ASMR(a6) struct Device *dev ASMREG(a6) )
+{
+	if( VSRC_ISXFER( io->io_Command ) )
+		vsrc[1].count++;
+	vsrc[1].oldBeginIO( io, dev );
+}
+
+
+/* runs at priority -127: counts whenever nobody else wants the CPU */
+SAVEDS void vsrc_IdleProc( void )
+{
+	while( !vsrc_idlequit )
+		vsrc_idlecount++;
+
+	/* don't let the parent unload our code before we're gone */
+	Forbid();
+	Signal( vsrc_parent, 1<<vsrc_idlesig );
+}
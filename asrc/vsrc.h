@@ -0,0 +1,34 @@
+/*
+  vsrc.h
+
+  (C)2026 Henryk Richter <henryk.richter@gmx.net>
+
+  purpose:
+   system activity monitor for the virtual LED sources
+   (VSRC1/VSRC2 arguments)
+
+*/
+#ifndef _INC_VSRC_H
+#define _INC_VSRC_H
+
+#include <exec/types.h>
+
+#include "config.h" /* config descriptor structure */
+
+/* number of virtual sources (keyboard: LEDB_SRC_VIRT1,LEDB_SRC_VIRT2) */
+#define VSRC_N 2
+
+/* polling interval (microseconds) */
+#define VSRC_TICK 100000
+
+/* CPU source is active above this load (percent) */
+#define VSRC_CPUBUSY 75
+
+/* set up monitors as given in VSRC1/VSRC2, returns number of active sources */
+LONG  vsrc_init( struct configvars *conf );
+/* current state: bit0 = VSRC1, bit1 = VSRC2 (call every VSRC_TICK) */
+ULONG vsrc_poll( void );
+/* remove patches, stop idle task */
+void  vsrc_exit( void );
+
+#endif /* _INC_VSRC_H */
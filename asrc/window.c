@@ -78,6 +78,7 @@ void UpdateSrcState( struct myWindow *win, ULONG code, struct Gadget *gad  );
 void UpdateCheckBox( struct myWindow *win, ULONG code, struct Gadget *gad );
 void ScaleXY( struct myWindow *win, USHORT *x, USHORT *y, USHORT *denom );
 void UpdateLEDButton( struct myWindow *win, ULONG code, struct Gadget *gad, struct myGadProto *prot );
+void UpdateLivePens( struct myWindow *win );
 LONG win_AddMenus( struct configvars *conf,struct myWindow *win);
 LONG win_FreeMenus( struct configvars *conf,struct myWindow *win);
 
@@ -117,13 +118,15 @@ LONG win_FreeMenus( struct configvars *conf,struct myWindow *win);
 const char levfmt[]= " %2lx "; /* level format for sliders */
 
 /* this order matches LEDB_* in ledmanager.h */
-STRPTR sourceStrings[7] = {    /* sources */
+STRPTR sourceStrings[9] = {    /* sources */
  (STRPTR)"No input",
  (STRPTR)"Power",
  (STRPTR)"Floppy",
  (STRPTR)"Auxiliary IN3",
  (STRPTR)"Auxiliary IN4",
  (STRPTR)"Capslock",
+ (STRPTR)"Virtual 1",
+ (STRPTR)"Virtual 2",
  NULL
 };
 STRPTR MXstateStrings[4] = {   /* MX state */
@@ -145,15 +148,17 @@ STRPTR ActiveStateStrings[9] = {   /* Text active */
  NULL
 };
 
-STRPTR ModeStrings[5] = {
+STRPTR ModeStrings[7] = {
  (STRPTR)"Fixed",
  (STRPTR)"CycleH",
  (STRPTR)"CycleV",
  (STRPTR)"CycleS",
+ (STRPTR)"Activity",
+ (STRPTR)"Strip FX",
  NULL
 };
 
-STRPTR StripModeStrings[8] = {   /* Text active */
+STRPTR StripModeStrings[9] = {   /* Text active */
  (STRPTR)"Static Color",
  (STRPTR)"Moving Dot",
  (STRPTR)"Rainbow slow",
@@ -161,6 +166,7 @@ STRPTR StripModeStrings[8] = {   /* Text active */
  (STRPTR)"Saturation",
  (STRPTR)"KITT",
  (STRPTR)"Splash",
+ (STRPTR)"Program",
  NULL
 };
 
@@ -231,13 +237,15 @@ extern LONG keyboard_version;
 #define CMD_PRESETWHITE  0x8000000A
 #define CMD_PRESETRGB    0x8000000B
 #define CMD_PRESETTEST   0x8000000C
+#define CMD_LIVE         0x8000000D
 
-#define DEF_ITEMS 15 
+#define DEF_ITEMS 16 
 struct NewMenu defmenus[DEF_ITEMS] = {
  {NM_TITLE,(STRPTR)"Project", 0, 0, 0, NULL },
  {NM_ITEM, (STRPTR)"About",0 , 0, 0, (APTR)CMD_ABOUT },
  {NM_ITEM, (STRPTR)"Load Preset",(STRPTR)"O" , 0, 0, (APTR)CMD_LOAD },
  {NM_ITEM, (STRPTR)"Save Preset",(STRPTR)"S" , 0, 0, (APTR)CMD_SAVE },
+ {NM_ITEM, (STRPTR)"Live LED State",(STRPTR)"L", CHECKIT|MENUTOGGLE, 0, (APTR)CMD_LIVE },
  {NM_ITEM, (STRPTR)"Hide", (STRPTR)"H", 0, 0, (APTR)CMD_HIDE },
  {NM_ITEM, (STRPTR)"Quit", (STRPTR)"Q", 0, 0, (APTR)CMD_QUIT },
  {NM_TITLE,(STRPTR)"Presets",0,0,0,NULL },
@@ -425,6 +433,7 @@ LONG Window_Close(struct configvars *conf, struct myWindow *win )
 	}
 	win->window = NULL;
 	win->sigmask = 0;
+	win->live_on = 0; /* menu comes back unchecked */
 
 	win_FreeMenus( conf, win );
 	DeleteGads(win);
@@ -523,7 +532,7 @@ void UpdateLEDButton( struct myWindow *win, ULONG code, struct Gadget *gad, stru
 	 map = ledmanager_getMode( LEDIDX_DFX ); // win->active_led );
 	 /*Printf((STRPTR)"DFX Map 0x%lx\n",(ULONG)map);*/
 	 if( win->StripRGB )
-		 GT_SetGadgetAttrs( win->StripRGB, win->window, NULL, GTCB_Checked, (map&(~MSK_MODESTRIP)) ? 1 : 0, TAG_DONE );
+		 GT_SetGadgetAttrs( win->StripRGB, win->window, NULL, GTCB_Checked, (map&RGB_MODESTRIP) ? 1 : 0, TAG_DONE );
 	 GT_SetGadgetAttrs( win->CycleDFX, win->window, NULL, GTCY_Active,(map&MSK_MODESTRIP),TAG_DONE);
 	}
 	else
@@ -534,7 +543,7 @@ void UpdateLEDButton( struct myWindow *win, ULONG code, struct Gadget *gad, stru
 	 GT_SetGadgetAttrs( win->SrcState,win->window,NULL,GA_Disabled,FALSE,TAG_DONE);
 	}
 
-	map = ledmanager_getMode( win->active_led ); /* get source configuration by state (code) */
+	map = ledmanager_getMode( win->active_led ) & MSK_MODELED; /* get source configuration by state (code) */
 	GT_SetGadgetAttrs( win->CycleMode, win->window, NULL, GTCY_Active,map,TAG_DONE);
 
 	color24  = ledmanager_getColor( ledidx, state, 0 )<<16;
@@ -569,6 +578,7 @@ void UpdateCycleMode( struct myWindow *win, ULONG code, struct Gadget *gad )
 		idx   = LEDIDX_DFX;
 		code |= map & (~MSK_MODESTRIP); /* keep all upper bits */
 	}
+	else	code |= ledmanager_getMode( idx ) & (~MSK_MODELED); /* keep animation speed */
 	ledmanager_setMode( idx, code );
 }
 
@@ -651,7 +661,7 @@ void UpdateSrcState( struct myWindow *win, ULONG code, struct Gadget *gad  )
 	 else   map++;   /* cycle is sorted by LEDB_ definitions */
 	 GT_SetGadgetAttrs( win->CycleSrc, win->window, NULL, GTCY_Active,map,TAG_DONE);
 
-	 map = ledmanager_getMode( win->active_led );
+	 map = ledmanager_getMode( win->active_led ) & MSK_MODELED;
 	 GT_SetGadgetAttrs( win->CycleMode,win->window, NULL, GTCY_Active,map,TAG_DONE);
 
 	 win->refreshlist |= ( (1<<ID_sliderR)|(1<<ID_sliderG)|(1<<ID_sliderB)|
@@ -661,10 +671,39 @@ void UpdateSrcState( struct myWindow *win, ULONG code, struct Gadget *gad  )
 	 RefreshGads(win, NULL, 0 ); 
 	}
 
+	if( win->live_on )
+		UpdateLivePens( win );
 
 }
 
 
+/*
+  live view: show the LEDs in the state reported by the keyboard,
+  the LED being edited keeps showing the edited state
+*/
+void UpdateLivePens( struct myWindow *win )
+{
+	SHORT i;
+	LONG  st;
+
+	for( i=0; i < N_LED ; i++ )
+	{
+		if( i == win->active_led )
+			continue;
+		st = ledmanager_getLiveState( i );
+		if( st < 0 ) /* no notification yet */
+			return;
+		SetRGB32(&win->screen->ViewPort, win->Pens[i],
+		         UMult32( ledmanager_getColor( i, st, 0 ), 0x01010101 ),
+		         UMult32( ledmanager_getColor( i, st, 1 ), 0x01010101 ),
+		         UMult32( ledmanager_getColor( i, st, 2 ), 0x01010101 ) );
+	}
+
+	win->refreshlist |= (1<<ID_LEDPower)|(1<<ID_LEDFloppy)|(1<<ID_LEDCaps);
+	RefreshGads(win, NULL, 0 ); 
+}
+
+
 /*
   - window context
   - gadget or tag list (depending on ICMP class)
@@ -958,6 +997,11 @@ LONG Window_Event(struct configvars *conf, struct myWindow *win )
 						case CMD_PRESETWHITE: updatePreset( win, LEDPR_WHITE   );break;
 						case CMD_PRESETRGB:   updatePreset( win, LEDPR_RGB     );break;
 						case CMD_PRESETTEST:  updatePreset( win, LEDPR_TEST    );break;
+						case CMD_LIVE:
+							win->live_on = (it->Flags & CHECKED) ? 1 : 0;
+							/* restore edited state, overlay live state */
+							UpdateSrcState( win, win->active_state, win->SrcState );
+							break;
 #if 0
 						case CMD_PRESETA500R:
 							ledmanager_setpreset( LEDPR_A500RED ); /* pre-defined color schemes */
@@ -1049,6 +1093,14 @@ LONG Window_Timer(struct configvars *conf, struct myWindow *win )
 	return 0;
 }
 
+/* keyboard notified new source states (see ledmanager_setLiveSources) */
+LONG Window_LiveState(struct configvars *conf, struct myWindow *win )
+{
+	if( (win->live_on) && (win->window) )
+		UpdateLivePens( win );
+	return 0;
+}
+
 
 void RefreshGads( struct myWindow *win, struct Gadget *gad, ULONG flags )
 {
@@ -107,6 +107,7 @@ struct myWindow {
 
 	ULONG	active_state;		/* current state 0-2 */
 	ULONG	active_led;             /* LED index */
+	ULONG	live_on;                /* 1 = mirror LED states reported by keyboard */
 
 	/* Keyboard comms */
 	ULONG	comm_timeouts;
@@ -122,6 +123,7 @@ struct myWindow *Window_Open( struct configvars *conf );
 LONG Window_Close(struct configvars *conf, struct myWindow *win );
 LONG Window_Event(struct configvars *conf, struct myWindow *win );
 LONG Window_Timer(struct configvars *conf, struct myWindow *win );
+LONG Window_LiveState(struct configvars *conf, struct myWindow *win );
 LONG Window_Destroy( struct configvars *conf, struct myWindow *win );
 
 
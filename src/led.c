@@ -25,13 +25,16 @@
 #include <avr/interrupt.h>
 #include <avr/pgmspace.h>
 #include <avr/eeprom.h> 
+#include <avr/wdt.h> /* led_saveconfig(): EEPROM writes outlast the watchdog period */
 //#include <avr/io.h>
 #include <util/delay.h> /* might be <avr/delay.h>, depending on toolchain */
+#include <util/crc16.h>
 //#include "avr/delay.h"
 #include "baxtypes.h"
 #include "twi.h"
 #include "kbdefs.h"
 #include "led.h"
+#include "led_digital.h"
 #include "gammatab.h"
 
 #define DEBUGONLY
@@ -66,6 +69,9 @@ extern unsigned char caps_on; /* CAPSLOCK state 0=off,1=on */
 
 /* LED controller address (twi.c needs address >>1) */
 #define I2CADDRESS (0x68>>1)
+/* PWM registers: 16 bit L/H for R,G,B per LED, auto-increment */
+#define LED_PWMREG   0x01
+#define LED_PWMBYTES (N_LED*3*2)
 
 /* 
   init string: 
@@ -75,7 +81,6 @@ extern unsigned char caps_on; /* CAPSLOCK state 0=off,1=on */
 #define MAXLEDINITSEQ 8
 const unsigned char ledinitlist[] PROGMEM = {
  2, 0x00, 0x07, /* [control register 0],[16 bit (0x6), normal op (0x1), 16 Bit (%000<<4)] */
- 2, 0x6E, 0x60, /* [Global Current Control],[enable full current (0x1-0xFF)]              */
  2, 0x70, 0xBF, /* [Phase Delay and Clock Phase],[PDE=1,PSn=1] */
  /* end of list */
  0
@@ -93,17 +98,93 @@ const unsigned char ledinitlist[] PROGMEM = {
 #define LED_STATES    3 
 #endif
 
-unsigned char get_secmap( unsigned char srcmap );
-
 unsigned char led_currentstate; /* current input source state    */
 unsigned char src_active;       /* source state as sent to LEDs  */
+unsigned char led_force;        /* 1 = next update sends all LEDs */
+unsigned char led_notify;       /* 1 = host wants source change notifications */
+unsigned char led_notified;     /* source state as last reported to host */
 
 unsigned char LED_SRCMAP[N_LED+N_LED_DIGI_CONF];    /* flags applying to this LED      */
-unsigned char LED_SECMAP[N_LED+N_LED_DIGI_CONF];    /* bit combinations (including SWAP flag) for secondary function */
-unsigned char LED_RGB[N_LED+N_LED_DIGI_CONF][LED_STATES][3]; /* RGB config for LEDs */
+unsigned char LED_RGB[N_LED+N_LED_DIGI_CONF][LED_NSTATES][3]; /* RGB config for LEDs */
 unsigned char LED_MODES[N_LED+N_LED_DIGI_CONF];     /* static,cycle, rainbow, knight rider etc. */
 unsigned char LED_MODESTATE[N_LED+N_LED_DIGI_CONF]; /* mode-private storage for current state */
 
+/*
+  LED state resolution: per LED a priority stack of (source mask, state)
+  entries, the first entry with an active source decides (none = idle).
+  The stack follows LED_SRCMAP (two sources and swap flag) or is set by
+  LEDX_SETSTACK. It is expanded into a table over all source states when
+  the configuration changes, 2 bits per state, so that resolving the state
+  of an LED is a single lookup.
+*/
+#define LED_MAXSTACK   4
+#define LED_NSRCSTATES (LEDF_ALLSTACK+1)
+unsigned char LED_STACK[N_LED][LED_MAXSTACK][2]; /* source mask, LED state; mask 0 = end of stack */
+unsigned char led_ownstack;                      /* LEDs (bits) with stack from LEDX_SETSTACK */
+unsigned char led_stackmask[N_LED];              /* all sources of the stack */
+unsigned char led_statetab[N_LED][LED_NSRCSTATES/4]; /* LED state per source state */
+static void led_setstack( unsigned char i );
+
+/* 
+  animation engine: fixed frame rate from timer 2, one phase accumulator
+  per LED, LED_MODESTATE is the upper byte of the phase
+*/
+#define LED_FRAMEDIV 2        /* animation frame every 2nd overflow (~30 fps) */
+uint16_t led_phase[N_LED];    /* animation phase */
+unsigned char led_framediv;
+unsigned char led_animdirty;  /* animated LEDs (bits) that need to be sent */
+
+/*
+  crossfade between LED states: blend of the 16 bit PWM values (i.e. after
+  gamma = linear light) from the value shown at the state change towards
+  the new state, driven by the animation frames
+*/
+unsigned char LED_FADE[N_LED];     /* transition time in frames (0 = instant) */
+unsigned char led_laststate[N_LED];/* LED state (idle/active/secondary) as last rendered */
+unsigned char led_fading;          /* LEDs (bits) mid-fade */
+uint16_t led_fadepos[N_LED];       /* fade position 0...0xFFFF */
+uint16_t led_fadestep[N_LED];      /* per frame */
+uint16_t led_fadefrom[N_LED][3];   /* 16 bit R,G,B at start of fade */
+#define LED_EEFADE (0x100+2+(N_LED+N_LED_DIGI_CONF)*11) /* EEPROM: 0xBA,'F',LED_FADE[N_LED] */
+
+/*
+  brightness envelopes in the current registers of the IS31FL3237 instead
+  of the PWM values:
+   - pulse: per channel scaling registers (0x4A...) = white balance * envelope,
+     the PWM values (color) stay untouched
+   - global dim and dim after an idle time: global current (0x6E)
+  The update latch (0x49) loads scaling registers together with PWM values,
+  the global current applies immediately.
+*/
+#define LED_SCALEREG   0x4A
+#define LED_SCALEBYTES (N_LED*3)
+#define LED_GCCREG     0x6E
+#define LED_GCCMAX     0x60   /* global current at full brightness (see ledinitlist) */
+#define LED_FPM        1840   /* animation frames per minute */
+const unsigned char led_balance[3] PROGMEM = { 0xFF, 0xFF, 0x5F }; /* R,G,B scaling (white balance) */
+unsigned char LED_DIM[3];          /* brightness, idle brightness (0...255), idle time in minutes (0 = never) */
+unsigned char led_scale[LED_SCALEBYTES];      /* shadow: scaling registers as written */
+unsigned char led_scalenew[LED_SCALEBYTES+1]; /* next scaling values at [1...], [0] = room for register address */
+unsigned char led_gcc;             /* global current as written */
+unsigned char led_scaleforce;      /* 1 = shadow invalid, send all scaling registers */
+uint16_t led_twierrors;            /* TWI errors seen so far (failed writes invalidate shadows) */
+unsigned char led_gccnext;         /* global current, ramping towards the target */
+unsigned char led_idlemin;         /* minutes without key activity */
+uint16_t led_idleframes;           /* frames in current minute */
+#define LED_EEDIM (LED_EEFADE+2+N_LED) /* EEPROM: 0xBA,'D',LED_DIM[3] */
+#define LED_EESTACK (LED_EEDIM+2+3)   /* EEPROM: 0xBA,'S',led_ownstack, per LED: LED_STACK, RGB of LED_TERTIARY */
+#define LED_EESTRIP (LED_EESTACK+3+N_LED*(LED_MAXSTACK*2+3)) /* EEPROM: 0xBA,'L',strip length */
+#define LED_EEPROG  (LED_EESTRIP+3) /* EEPROM: 0xBA,'P',length,strip effect program (LEDD_PROGMAX) */
+/* phase increment per frame for speed 0, full cycle = 65536/increment frames */
+const uint16_t led_modespeed[LEDM_NMODES] PROGMEM = {
+ 0,   /* LEDM_STATIC  */
+ 256, /* LEDM_RAINBOW ~8.4s */
+ 512, /* LEDM_PULSE   ~4.2s */
+ 512, /* LEDM_SAT     ~4.2s */
+ 0,   /* LEDM_ACTIVITY */
+ 0    /* LEDM_CANVAS: frames of led_digital_step() */
+};
+
 /* 
   TWI command list: 
    1 Byte LED, 1 Byte STATE
@@ -114,22 +195,131 @@ uint8_t initseq[MAXLEDINITSEQ];
 
 #endif
 
-void adc_start( unsigned  char channel )
+/*
+  analog inputs (POWER, FLOPPY): ADC in free running mode at fr/128,
+  i.e. one conversion every 104 us, the interrupt alternates between
+  both channels (~4.8 kHz per input). The raw samples are evaluated
+  right in the interrupt (no further filtering, the POWER mean and the
+  activity windows below do the smoothing). The main loop only picks up
+  adc_state, whatever the scan or LED load.
+
+  Activity inputs (FLOPPY, IN3, IN4) are sampled along with every
+  FLOPPY result (208 us): FLOPPY with hysteresis on the unfiltered value,
+  IN3/IN4 as digital pins (port F has no pin change interrupts). A source
+  turns on with the first active sample and off after ACT_HOLD windows
+  (~27 ms each) without activity, so a 1 ms access stays visible. The
+  share of active samples per window is the activity duty (act_duty[]).
+  POWER: three levels off/dim/bright (A500: dim = audio filter off),
+  from the mean over 480 samples (~100 ms = 5 PAL or 6 NTSC frames),
+  so that a power LED that is pulse width modulated by software
+  (frame synchronous) is classified by its average. Bright is
+  LEDF_SRC_POWER as before, dim is LEDF_SRC_PDIM.
+
+  In free running mode, the next conversion has already started when
+  the interrupt comes. A new channel applies to the conversion after
+  that, so the interrupt selects the channel of the result it just got.
+*/
+#define ADC_PWRWINDOW   480
+/* thresholds (8 bit, 5V = 256): off below [0], on above [1] */
+const unsigned char adc_thresh[2] PROGMEM = { 120, 136 }; /* FLOPPY: around 2.5V */
+/* POWER: off/dim at [0]/[1], dim/bright at [2]/[3] (bright: >4.15V, 850/1024 before) */
+const unsigned char adc_pwrthresh[4] PROGMEM = { 96, 104, 204, 212 };
+volatile unsigned char adc_state;     /* LEDF_SRC_POWER, LEDF_SRC_PDIM, activity sources (stretched) */
+unsigned char adc_ch;                 /* channel of the next result */
+uint32_t adc_pwrsum;                  /* POWER: sum over current window */
+uint16_t adc_pwrcount;
+
+#define ACT_NCH    3   /* FLOPPY, IN3, IN4 */
+#define ACT_WINDOW 128 /* samples per window (~27 ms) */
+#define ACT_HOLD   2   /* windows without activity until the source turns off */
+const unsigned char act_src[ACT_NCH] PROGMEM = { LEDF_SRC_FLOPPY, LEDF_SRC_IN3, LEDF_SRC_IN4 };
+volatile unsigned char act_duty[ACT_NCH]; /* active samples in last window, 0...255 */
+unsigned char act_count[ACT_NCH];
+unsigned char act_hold[ACT_NCH];
+unsigned char act_win;
+unsigned char act_floppy;             /* FLOPPY sample state (hysteresis) */
+
+/* POWER: mean of last window (as sum) to off/dim/bright, with hysteresis */
+static unsigned char adc_pwrclass( uint32_t sum, unsigned char old )
 {
-  ADMUX  = (ADMUX&0xE0)|(channel & 0x7); /* select ADC channel 0 (channels 0-7 in lower 3 bits) */
-  ADCSRA |= (1<<ADSC); /* start ADC (single conversion) */
+#define ADC_PWRSUM(_i_) ( (uint32_t)pgm_read_byte( &adc_pwrthresh[_i_] ) * ADC_PWRWINDOW )
+	if( sum > ADC_PWRSUM(3) )
+		return LEDF_SRC_POWER;
+	if( sum >= ADC_PWRSUM(2) ) /* dim/bright band: keep bright */
+		return (old & LEDF_SRC_POWER) ? LEDF_SRC_POWER : LEDF_SRC_PDIM;
+	if( sum > ADC_PWRSUM(1) )
+		return LEDF_SRC_PDIM;
+	if( sum >= ADC_PWRSUM(0) ) /* off/dim band: keep off */
+		return (old) ? LEDF_SRC_PDIM : 0;
+	return 0;
+#undef ADC_PWRSUM
 }
 
-uint16_t adc_get( void )
-{ 
-  uint8_t  AinLow;
-  uint16_t Ain;
+ISR(ADC_vect)
+{
+	unsigned char ch = adc_ch;
+	unsigned char x,lvl,old,k;
 
-  AinLow = (int)ADCL;         /* lower 8 bit */
-  Ain = ((uint16_t)ADCH)<<8;  /* upper two bit, shifted */
-  Ain = Ain|AinLow;
+	ADMUX  = (ADMUX & 0xE0) | ch; /* for the conversion after the running one */
+	adc_ch = ch ^ 1;
 
-  return Ain;
+	x = ADCH;
+
+	if( !ch )
+	{
+		/* POWER */
+		adc_pwrsum += x;
+		if( ++adc_pwrcount < ADC_PWRWINDOW )
+			return;
+		old = adc_state & (LEDF_SRC_POWER|LEDF_SRC_PDIM);
+		lvl = adc_pwrclass( adc_pwrsum, old );
+		adc_pwrsum   = 0;
+		adc_pwrcount = 0;
+		if( lvl != old )
+			adc_state = (adc_state & ~(LEDF_SRC_POWER|LEDF_SRC_PDIM)) | lvl;
+		return;
+	}
+
+	/* FLOPPY, IN3, IN4 */
+	if( act_floppy )
+	{
+		if( x < pgm_read_byte( &adc_thresh[0] ) )
+			act_floppy = 0;
+	}
+	else
+	{
+		if( x > pgm_read_byte( &adc_thresh[1] ) )
+			act_floppy = LEDF_SRC_FLOPPY;
+	}
+	lvl = act_floppy;
+	if( !(IN3LED_PIN & (1<<IN3LED_BIT)) ) /* low active */
+		lvl |= LEDF_SRC_IN3;
+	if( !(IN4LED_PIN & (1<<IN4LED_BIT)) )
+		lvl |= LEDF_SRC_IN4;
+	adc_state |= lvl; /* on at once */
+
+	for( k=0 ; k < ACT_NCH ; k++ )
+	{
+		if( lvl & pgm_read_byte( &act_src[k] ) )
+			act_count[k]++;
+	}
+	if( ++act_win < ACT_WINDOW )
+		return;
+	act_win = 0;
+
+	/* end of window: duty, off after ACT_HOLD idle windows */
+	for( k=0 ; k < ACT_NCH ; k++ )
+	{
+		x = act_count[k];
+		act_count[k] = 0;
+		act_duty[k]  = ( x >= ACT_WINDOW ) ? 255 : x*(256/ACT_WINDOW);
+		if( x )
+			act_hold[k] = ACT_HOLD;
+		else if( act_hold[k] )
+			act_hold[k]--;
+		if( !act_hold[k] )
+			adc_state &= ~pgm_read_byte( &act_src[k] );
+	}
 }
 
 unsigned char update_bit( unsigned char old_state, unsigned char decision, unsigned char flag )
@@ -180,61 +370,42 @@ uint8_t led_setinputstate( uint8_t source, uint8_t state )
   return led_currentstate;
 }
 
-/* scan inputs, return current state of all inputs, return quickly */
-/*
-   some inputs may be analog and need to be muxed,
-   hence the returned state is not instantaneus. 
-   
-   This function will initialize ADC and update the input states
-   once an ADC cycle is completed. 
+/* 
+  enable/disable source change notifications,
+  check whether the host needs to know about a changed source state
+  - the state is reported as key-up code, so that a regular keyboard.device
+    (i.e. host tool not running) won't see key presses
 
+  returns 0 when there is nothing to send
 */
-unsigned char adc_cycle;
-unsigned char led_getinputstate()
+void led_setnotify( unsigned char on )
 {
- uint16_t ad;
+	led_notify   = on;
+	led_notified = 0xff; /* report current state right away */
+}
 
-	led_currentstate = (caps_on) ? led_currentstate|LEDF_SRC_CAPS : led_currentstate&(~LEDF_SRC_CAPS);
+unsigned char led_notifystate( unsigned char state )
+{
+	if( !led_notify )
+		return 0;
 
-	/* cycle through ADCs */
-	switch( adc_cycle )
-	{
-		case 0:
-			adc_start(0); /* channel0: POWER LED */
-			adc_cycle++;
-			break;
-		case 1: /* Power LED: >4.15V = ON (5*850/1024) */
-			if( (ADCSRA&(1<<ADIF))==0 ) /* wait for ADC */
-				break;
-			ad = adc_get( );
-			led_currentstate = update_bit( led_currentstate, ad>850, LEDF_SRC_POWER );
-			adc_cycle++;
-				break;
-			//led_currentstate = (ad > 850) ?  led_currentstate|LEDF_SRC_POWER : led_currentstate&(~LEDF_SRC_POWER);
+	state = (state & (LEDF_ALL & ~LEDF_SRC_VIRT)) | ((state & LEDF_SRC_PDIM) ? LEDN_PDIM : 0);
+	if( state == led_notified )
+		return 0;
 
-		case 2:
-			adc_start(1); /* channel1: FLOPPY LED */
-			adc_cycle++;
-			break;
-		case 3:	/* FLOPPY LED: >2.5V = on, else off */
-			if( (ADCSRA&(1<<ADIF))==0 ) /* wait for ADC */
-				break;
-			ad = adc_get();
-			led_currentstate = update_bit( led_currentstate, ad>512, LEDF_SRC_FLOPPY );
-			adc_cycle++;
-			break;
-			//led_currentstate = (ad > 512) ? led_currentstate|LEDF_SRC_FLOPPY : led_currentstate&(~LEDF_SRC_FLOPPY);
+	led_notified = state;
+	return state|0x80;
+}
 
-		case 4: /* IN3, IN4: digital for now, low active */
-			led_currentstate = update_bit( led_currentstate, 0==(IN3LED_PIN&(1<<IN3LED_BIT)), LEDF_SRC_IN3 );
-			led_currentstate = update_bit( led_currentstate, 0==(IN4LED_PIN&(1<<IN4LED_BIT)), LEDF_SRC_IN4 );
-			adc_cycle++;
-			break;
+/* scan inputs, return current state of all inputs, return quickly */
+/*
+   all inputs but CAPS are sampled in the ADC interrupt (see above)
+*/
+unsigned char led_getinputstate()
+{
+	led_currentstate = (caps_on) ? led_currentstate|LEDF_SRC_CAPS : led_currentstate&(~LEDF_SRC_CAPS);
 
-		default:
-			adc_cycle = 0;
-			break;
-	}
+	led_currentstate = (led_currentstate & ~(LEDF_SRC_POWER|LEDF_SRC_PDIM|LEDF_SRC_FLOPPY|LEDF_SRC_IN3|LEDF_SRC_IN4)) | adc_state;
 
 	return led_currentstate;
 }
@@ -540,58 +711,46 @@ void cycle_rainbow( uint8_t *rgb, uint8_t increment )
 
 
 unsigned char twi_ledupdate_pos;
-unsigned char led_sending;
-void twi_ledupdate_callback( uint8_t address, uint8_t *data )
+unsigned char led_sending;     /* 1 = burst queued, latch still to be queued */
+unsigned char led_pwmforce;    /* 1 = shadow invalid, send all PWM registers */
+unsigned char led_pwm[LED_PWMBYTES];      /* shadow: PWM registers as written to IS31FL3237 */
+unsigned char led_pwmnew[LED_PWMBYTES+1]; /* next PWM register values at [1...], [0] = room for register address */
+
+/* compute color of LED i in state t into led_pwmnew[] (gamma corrected, 16 bit L/H) */
+static void led_computepwm( unsigned char i, unsigned char t )
 {
-	unsigned char i,t;
 	unsigned char led_cur[3];
-
-	/* a little delay between consecutive TWI writes */
-	_delay_us(4);
-
-	i=twicmds[twi_ledupdate_pos]; /* get target LED */
-	if( i == TCMD_END ) /* end of list: commit changes */
-	{
-		initseq[0] = 0x49;
-		initseq[1] = 0x00;
-		twi_write(I2CADDRESS, initseq, 2, (0) ); /* No more callback */
-		led_sending = 0;
-		return;
-	}
-	t = twicmds[twi_ledupdate_pos+1]; /* get state index */
-
-	initseq[0] = 0x01+i*3*2; /* LED index to hardware register */
+	unsigned char *pwm = &led_pwmnew[1+i*6];
 
 	led_cur[0] = LED_RGB[i][t][0];
 	led_cur[1] = LED_RGB[i][t][1];
 	led_cur[2] = LED_RGB[i][t][2];
 
-	switch( LED_MODES[i] )
+	switch( LED_MODES[i] & LEDM_MASK )
 	{
 	 case LEDM_STATIC:
+	 case LEDM_PULSE: /* envelope in scaling registers, see led_computescale() */
+	 case LEDM_ACTIVITY:
 	 	break;
 	 case LEDM_RAINBOW:
-		LED_MODESTATE[i]++;
 		cycle_rainbow( led_cur, LED_MODESTATE[i] );
 		break;
-	 case LEDM_PULSE:
+	 case LEDM_CANVAS:
+		/* idle: pixel of the strip effect, active states keep their color */
+		if( t == LED_IDLE )
 		{
-		 unsigned char d,c = LED_MODESTATE[i]+1;
-		 LED_MODESTATE[i] = c;
-		 if( c > 127 ) c = 255-c;
+			unsigned char *c = led_digital_canvas( i );
 
-		 for( d=0 ; d < 3 ; d++ )
-		 {
-			led_cur[d] = ((int)led_cur[d] * (int)c + 32)>>7;
-		 }
+			led_cur[0] = c[0];
+			led_cur[1] = c[1];
+			led_cur[2] = c[2];
 		}
 		break;
 	 //case LEDM_SAT:
 	 default:
 		{
-		 unsigned char d,c = LED_MODESTATE[i]+1;
+		 unsigned char d,c = LED_MODESTATE[i];
 		 int dif,sum;
-		 LED_MODESTATE[i] = c;
 		 if( c > 127 ) c = 255-c;
 
 		 sum = ((int)led_cur[0] + (int)led_cur[1] + (int)led_cur[1] + (int)led_cur[2])>>2;
@@ -604,31 +763,204 @@ void twi_ledupdate_callback( uint8_t address, uint8_t *data )
 		}
 	 	break;
 	}
-#if 1
-	initseq[1] = pgm_read_byte(&gamma24_tableLH[led_cur[0]][GAMMATAB_L]); /* red L */
-	initseq[2] = pgm_read_byte(&gamma24_tableLH[led_cur[0]][GAMMATAB_H]); /* red H */
-	initseq[3] = pgm_read_byte(&gamma24_tableLH[led_cur[1]][GAMMATAB_L]); /* grn L */
-	initseq[4] = pgm_read_byte(&gamma24_tableLH[led_cur[1]][GAMMATAB_H]); /* grn H */
-	initseq[5] = pgm_read_byte(&gamma24_tableLH[led_cur[2]][GAMMATAB_L]); /* blu L */
-	initseq[6] = pgm_read_byte(&gamma24_tableLH[led_cur[2]][GAMMATAB_H]); /* blu H */
-#else
-	/* TODO: Gamma table */
-	initseq[1] = (LED_RGB[i][t][0]<<4);  /* red L */
-	initseq[2] = (LED_RGB[i][t][0]>>4);  /* red H */
-	initseq[3] = (LED_RGB[i][t][1]<<4);  /* grn L */
-	initseq[4] = (LED_RGB[i][t][1]>>4);  /* grn H */
-	initseq[5] = (LED_RGB[i][t][2]<<4);  /* blu L */
-	initseq[6] = (LED_RGB[i][t][2]>>4);  /* blu H */
-#endif
-	twi_ledupdate_pos+=2;
 
-	twi_write(I2CADDRESS, initseq, 7, twi_ledupdate_callback );
+	pwm[0] = pgm_read_byte(&gamma24_tableLH[led_cur[0]][GAMMATAB_L]); /* red L */
+	pwm[1] = pgm_read_byte(&gamma24_tableLH[led_cur[0]][GAMMATAB_H]); /* red H */
+	pwm[2] = pgm_read_byte(&gamma24_tableLH[led_cur[1]][GAMMATAB_L]); /* grn L */
+	pwm[3] = pgm_read_byte(&gamma24_tableLH[led_cur[1]][GAMMATAB_H]); /* grn H */
+	pwm[4] = pgm_read_byte(&gamma24_tableLH[led_cur[2]][GAMMATAB_L]); /* blu L */
+	pwm[5] = pgm_read_byte(&gamma24_tableLH[led_cur[2]][GAMMATAB_H]); /* blu H */
+
+	if( led_fading & (1<<i) )
+	{
+		unsigned char c,w = led_fadepos[i]>>8;
+		uint16_t from,to;
+
+		for( c=0 ; c < 3 ; c++, pwm+=2 )
+		{
+			from = led_fadefrom[i][c];
+			to   = ((uint16_t)pwm[1]<<8) | pwm[0];
+			from += (int16_t)( ( ((int32_t)to - (int32_t)from) * w ) >> 8 );
+			pwm[0] = (unsigned char)from;
+			pwm[1] = (unsigned char)(from>>8);
+		}
+	}
+}
+
+/*
+  activity intensity per activity input, updated per animation frame from
+  the duty of the last window: any activity starts at ACT_MIN, full duty
+  is full brightness, rises at once, falls by 1/8 per frame (the source
+  itself is stretched in the ADC interrupt)
+*/
+#define ACT_MIN 128
+unsigned char led_actlevel[ACT_NCH];
+
+static void led_actframe( void )
+{
+	unsigned char k,t,l;
+
+	for( k=0 ; k < ACT_NCH ; k++ )
+	{
+		t = act_duty[k];
+		if( t || (adc_state & pgm_read_byte( &act_src[k] )) )
+			t = ACT_MIN + ( ((uint16_t)t * (255-ACT_MIN))>>8 );
+		l = led_actlevel[k];
+		if( t >= l )
+			l = t;
+		else	l -= (l-t+7)>>3;
+		led_actlevel[k] = l;
+	}
+}
+
+/* scaling registers of LED i: white balance, times pulse envelope */
+static void led_computescale( unsigned char i )
+{
+	unsigned char c,env = 0xff;
+	unsigned char *scale = &led_scalenew[1+i*3];
+
+	switch( LED_MODES[i] & LEDM_MASK )
+	{
+	 case LEDM_PULSE:
+		/* triangle in (nonlinear) 8 bit domain as before, mapped to
+		   linear current: gamma(c*rgb) = gamma(c)*gamma(rgb) */
+		env = LED_MODESTATE[i];
+		if( env > 127 ) env = 255-env;
+		env = pgm_read_byte(&gamma24_tableLH[env<<1][GAMMATAB_H]);
+		break;
+	 case LEDM_ACTIVITY:
+		/* strongest activity among the sources of the LED, idle color unscaled */
+		if( led_laststate[i] == LED_IDLE )
+			break;
+		env = 0;
+		for( c=0 ; c < ACT_NCH ; c++ )
+		{
+			if( (led_stackmask[i] & pgm_read_byte( &act_src[c] )) && (led_actlevel[c] > env) )
+				env = led_actlevel[c];
+		}
+		if( !( led_stackmask[i] & (LEDF_SRC_FLOPPY|LEDF_SRC_IN3|LEDF_SRC_IN4) ) )
+			env = 0xff; /* no activity source */
+		env = pgm_read_byte(&gamma24_tableLH[env][GAMMATAB_H]);
+		break;
+	}
+
+	for( c=0 ; c < 3 ; c++ )
+		scale[c] = ( (uint16_t)pgm_read_byte(&led_balance[c]) * (uint16_t)(env+1) )>>8;
+}
+
+/* global current for brightness, or idle brightness once the idle time is over */
+static unsigned char led_dimtarget( void )
+{
+	unsigned char b = LED_DIM[0];
+
+	if( LED_DIM[2] && (led_idlemin >= LED_DIM[2]) && (LED_DIM[1] < b) )
+		b = LED_DIM[1];
+
+	return ( (uint16_t)LED_GCCMAX * (uint16_t)(b+1) )>>8;
+}
+
+/* key activity: restart idle time (wake up in next frame) */
+void led_activity( void )
+{
+	led_idleframes = 0;
+	led_idlemin    = 0;
+}
+
+/* LED i changes to state t: start crossfade from the currently shown value */
+static void led_startfade( unsigned char i, unsigned char t )
+{
+	unsigned char c,*pwm;
+
+	if( t == led_laststate[i] )
+		return;
+	led_laststate[i] = t;
+	if( !LED_FADE[i] )
+		return;
+
+	pwm = &led_pwmnew[1+i*6];
+	for( c=0 ; c < 3 ; c++, pwm+=2 )
+		led_fadefrom[i][c] = ((uint16_t)pwm[1]<<8) | pwm[0];
+	led_fadepos[i]  = 0;
+	led_fadestep[i] = 0xFFFF / LED_FADE[i];
+	led_fading     |= (1<<i);
+}
+
+/*
+  LED update from twicmds[] list: compute new PWM values, compare them 
+  against the shadow copy and write the dirty range in one auto-increment
+  transaction, followed by the update latch (0x49)
+
+  per full refresh of 7 LEDs at 200 kHz (9 bit times per byte):
+   before: 7 transactions of SLA+REG+6 plus latch = 59 bytes, ~2.8 ms
+   now:    1 transaction of SLA+REG+42 plus latch = 47 bytes, ~2.2 ms
+  (400 kHz: ~1.1 ms, 1 MHz: ~0.45 ms, see TWI_FREQ)
+  a typical source change (e.g. three floppy segments) shrinks to the
+  bytes that actually differ
+
+  Everything here runs in main loop context, the TWI interrupt only
+  streams the queued bytes (no callback). The caller queues the latch
+  behind the burst(s) by led_latch().
+*/
+static void led_sendrange( unsigned char reg, unsigned char *shadow, unsigned char *regnew, unsigned char n, unsigned char force )
+{
+	unsigned char i,first,last,save;
+
+	/* dirty range */
+	first = 0;
+	last  = n-1;
+	if( !force )
+	{
+		while( (first < n) && (shadow[first] == regnew[1+first]) )
+			first++;
+		if( first >= n )
+			return; /* nothing changed */
+		while( shadow[last] == regnew[1+last] )
+			last--;
+	}
+
+	for( i=first ; i <= last ; i++ )
+		shadow[i] = regnew[1+i];
+
+	/* register address in front of the range (twi_write() copies the data) */
+	save = regnew[first];
+	regnew[first] = reg + first;
+	led_sending = 1;
+	twi_write(I2CADDRESS, &regnew[first], last-first+2, (0) );
+	regnew[first] = save;
+}
+
+/* new PWM values for the LEDs in twicmds[] */
+static void led_sendframe( void )
+{
+	unsigned char i;
+
+	/* new colors for all LEDs in list */
+	while( (i=twicmds[twi_ledupdate_pos]) != TCMD_END )
+	{
+		led_computepwm( i, twicmds[twi_ledupdate_pos+1] );
+		twi_ledupdate_pos+=2;
+	}
+
+	led_sendrange( LED_PWMREG, led_pwm, led_pwmnew, LED_PWMBYTES, led_pwmforce );
+	led_pwmforce = 0;
+}
+
+/* latch new PWM and scaling values after the queued burst(s) */
+static void led_latch( void )
+{
+	if( !led_sending )
+		return;
+
+	initseq[0] = 0x49;
+	initseq[1] = 0x00;
+	twi_write(I2CADDRESS, initseq, 2, (0) );
+	led_sending = 0;
 }
 
 
 char led_putcommands( unsigned char *recvcmd, unsigned char nrecv )
 {
-	unsigned char index,st,r,g,b;
+	unsigned char index,st,r,g,b,progok = 0;
 	char confget = -1,needsave = -1;
 	unsigned char *sendbuf = recvcmd; /* just re-use the command buffer */
 
@@ -645,6 +977,131 @@ char led_putcommands( unsigned char *recvcmd, unsigned char nrecv )
 			case LEDCMD_GETVERSION:
 				confget = 0x7F; /* trigger version requested */
 				break;
+			case LEDCMD_EXT:
+				if( index == LEDX_GETCRC )
+					confget = 0x7E; /* trigger config CRC requested */
+				else if( (index & ~LEDX_VSRC_MASK) == LEDX_SETVSRC )
+				{
+					/* virtual sources: picked up by next led_updatecontroller() */
+					led_currentstate = (led_currentstate & ~LEDF_SRC_VIRT) |
+					                   ((index & LEDX_VSRC_MASK)<<LEDB_SRC_VIRT1);
+				}
+				else if( index == LEDX_FRAME )
+				{
+					if( nrecv < 1 )
+					{
+						nrecv = 0;
+						break;
+					}
+					nrecv--;
+					r = *recvcmd++; /* frame length */
+					if( r > nrecv )
+						r = nrecv;
+					led_digital_putframe( recvcmd, r );
+					recvcmd += r;
+					nrecv   -= r;
+				}
+				else if( (index & ~1) == LEDX_NOTIFY )
+					led_setnotify( index & 1 );
+				else if( index == LEDX_SETFADE )
+				{
+					if( nrecv < 2 )
+					{
+						nrecv = 0;
+						break;
+					}
+					nrecv -= 2;
+					r = *recvcmd++; /* LED */
+					g = *recvcmd++; /* frames */
+					for( st=0 ; st < N_LED ; st++ )
+					{
+						if( (r == 0xff) || (r == st) )
+							LED_FADE[st] = g;
+					}
+				}
+				else if( index == LEDX_SETDIM )
+				{
+					if( nrecv < 3 )
+					{
+						nrecv = 0;
+						break;
+					}
+					nrecv -= 3;
+					LED_DIM[0] = *recvcmd++; /* brightness      */
+					LED_DIM[1] = *recvcmd++; /* idle brightness */
+					LED_DIM[2] = *recvcmd++; /* idle minutes    */
+				}
+				else if( index == LEDX_SETSTACK )
+				{
+					if( nrecv < 2 )
+					{
+						nrecv = 0;
+						break;
+					}
+					r = recvcmd[0]; /* LED */
+					g = recvcmd[1]; /* number of entries */
+					if( (g > LED_MAXSTACK) || (nrecv < 2+(g<<1)) )
+					{
+						nrecv = 0;
+						break;
+					}
+					nrecv   -= 2+(g<<1);
+					recvcmd += 2;
+					if( r < N_LED )
+					{
+						for( st=0 ; st < LED_MAXSTACK ; st++ )
+						{
+							b = ( st < g ) ? recvcmd[(st<<1)+1] : LED_IDLE;
+							LED_STACK[r][st][0] = ( st < g ) ? recvcmd[st<<1] & LEDF_ALLSTACK : 0;
+							LED_STACK[r][st][1] = ( b < LED_NSTATES ) ? b : LED_IDLE;
+						}
+						led_ownstack = (g) ? led_ownstack|(1<<r) : led_ownstack&~(1<<r);
+						led_setstack( r );
+					}
+					recvcmd += g<<1;
+				}
+				else if( index == LEDX_SETSTRIP )
+				{
+					if( nrecv < 1 )
+					{
+						nrecv = 0;
+						break;
+					}
+					nrecv--;
+					led_digital_setlength( *recvcmd++ );
+				}
+				else if( index == LEDX_SETPROG )
+				{
+					if( nrecv < 1 )
+					{
+						nrecv = 0;
+						break;
+					}
+					nrecv--;
+					r = *recvcmd++; /* program length */
+					if( r > nrecv )
+					{
+						nrecv = 0;
+						break;
+					}
+					progok   = led_digital_setprog( recvcmd, r );
+					confget  = 0x7D; /* trigger program status reply */
+					recvcmd += r;
+					nrecv   -= r;
+				}
+				else if( index == LEDX_STRIPNOTE )
+				{
+					if( nrecv < 5 )
+					{
+						nrecv = 0;
+						break;
+					}
+					nrecv -= 5;
+					led_digital_notify( recvcmd[0], recvcmd[1], recvcmd[2], recvcmd[3], recvcmd[4] );
+					recvcmd += 5;
+				}
+				else	nrecv = 0;      /* unknown sub-command: stop loop */
+				break;
 			case LEDCMD_GETCONFIG:
 				if( !nrecv )
 					break;
@@ -663,7 +1120,8 @@ char led_putcommands( unsigned char *recvcmd, unsigned char nrecv )
 				if( index >= (N_LED+N_LED_DIGI_CONF) )
 					break;
 				LED_SRCMAP[index] = r;
-				LED_SECMAP[index] = get_secmap(r); /* bit combinations (including SWAP flag) for secondary function */
+				if( index < N_LED )
+					led_setstack( index );
 				break;
 			case LEDCMD_SETMODE:
 				if( !nrecv )
@@ -674,7 +1132,9 @@ char led_putcommands( unsigned char *recvcmd, unsigned char nrecv )
 					break;
 				LED_MODES[index] = r;
 				LED_MODESTATE[index] = 0;
-					break;
+				if( index < N_LED )
+					led_phase[index] = 0;
+				break;
 			case LEDCMD_COLOR:
 				if( nrecv < 4 )
 				{
@@ -687,7 +1147,7 @@ char led_putcommands( unsigned char *recvcmd, unsigned char nrecv )
 				g  = *recvcmd++;
 				b  = *recvcmd++;
 
-				if( (st < LED_STATES) && (index < (N_LED+N_LED_DIGI_CONF) ) )
+				if( (st < LED_NSTATES) && (index < (N_LED+N_LED_DIGI_CONF) ) )
 				{
 					LED_RGB[index][st][0] = r;
 					LED_RGB[index][st][1] = g;
@@ -732,6 +1192,24 @@ char led_putcommands( unsigned char *recvcmd, unsigned char nrecv )
 
 			return 3;
 		}
+		if( confget == 0x7E )
+		{
+			uint16_t crc = led_configcrc();
+
+			*sendbuf++ = LEDGV_HEADER;    /* 0xBA */
+			*sendbuf++ = (unsigned char)(crc>>8);
+			*sendbuf++ = (unsigned char)crc;
+			return 3;
+		}
+		if( confget == 0x7D )
+		{
+			unsigned char *prog;
+
+			*sendbuf++ = LEDGV_HEADER;    /* 0xBA */
+			*sendbuf++ = progok;
+			*sendbuf++ = led_digital_getprog( &prog );
+			return 3;
+		}
 
 		*sendbuf++ = LED_SRCMAP[(unsigned char)confget];
 		for( st = 0 ; st < LED_STATES ; st++ )
@@ -757,119 +1235,296 @@ char led_putcommands( unsigned char *recvcmd, unsigned char nrecv )
 }
 
 
-/* bit combinations (including SWAP flag) for secondary function 
+/* CRC16 of the active configuration
 
-   returns bogus comparison value (0xff) if no bit was set in "srcmap"
+   The CRC is calculated across the same byte sequence that
+   LEDCMD_GETCONFIG returns for each LED (SRCMAP, 3*RGB, MODE), for
+   all LEDs including the digital LED config. The Amiga side uses it
+   as key for a cached copy of the config, so that a full readback
+   is only necessary when something has changed.
 */
-unsigned char get_secmap( unsigned char srcmap )
+uint16_t led_configcrc( void )
 {
-	unsigned char ret = 0;
-	int j,pripos,secpos;
-
-	pripos = -1; /* lower bit */
-	secpos = -1; /* upper bit */
+	uint16_t crc = 0xFFFF;
+	unsigned char i,st;
 
-	/* identify the two active bits (lower bit first, then upper bit) */
-	for( j = 0 ; j < 7 ; j++ )
+	for( i=0 ; i < (N_LED+N_LED_DIGI_CONF) ; i++ )
 	{
-		if( srcmap & (1<<j) )
+		crc = _crc_xmodem_update( crc, LED_SRCMAP[i] );
+		for( st = 0 ; st < LED_STATES ; st++ )
 		{
-			pripos = j;
-			j++;
-			break;
+			crc = _crc_xmodem_update( crc, LED_RGB[i][st][0] );
+			crc = _crc_xmodem_update( crc, LED_RGB[i][st][1] );
+			crc = _crc_xmodem_update( crc, LED_RGB[i][st][2] );
 		}
+		crc = _crc_xmodem_update( crc, LED_MODES[i] );
+	}
+
+	return crc;
+}
+
+
+/* priority stack from LED_SRCMAP: the lower source is primary, the upper
+   source is secondary (i.e. wins while the lower source is inactive),
+   swap flag: the other way round, further sources act as primary */
+static void led_srcmapstack( unsigned char i )
+{
+	unsigned char map = LED_SRCMAP[i] & LEDF_ALL;
+	unsigned char lo,hi,sec;
+	unsigned char *e = &LED_STACK[i][0][0];
+
+	lo = map & (unsigned char)(-map);           /* lowest source  */
+	hi = map & ~lo;
+	hi = hi & (unsigned char)(-hi);             /* second source  */
+
+	if( LED_SRCMAP[i] & LEDF_MAP_SWAP )
+		sec = (hi) ? hi : lo;
+	else	sec = (hi) ? lo : 0;
+
+	if( map & ~sec )
+	{
+		*e++ = map & ~sec;
+		*e++ = LED_ACTIVE;
+	}
+	if( sec )
+	{
+		*e++ = sec;
+		*e++ = LED_SECONDARY;
 	}
-	for(  ; j < 7 ; j++ )
+	*e = 0; /* end of stack */
+}
+
+/* expand the stack of LED i into the state table (all source states) */
+static void led_buildstatetab( unsigned char i )
+{
+	unsigned char k,t,mask = 0;
+	uint16_t s;
+	unsigned char *tab = led_statetab[i];
+
+	for( k=0 ; (k < LED_MAXSTACK) && LED_STACK[i][k][0] ; k++ )
+		mask |= LED_STACK[i][k][0];
+	led_stackmask[i] = mask;
+
+	for( s=0 ; s < LED_NSRCSTATES ; s++ )
 	{
-		if( srcmap & (1<<j) )
+		t = LED_IDLE;
+		for( k=0 ; (k < LED_MAXSTACK) && LED_STACK[i][k][0] ; k++ )
 		{
-			secpos = j;
-			break;
+			if( s & LED_STACK[i][k][0] ) /* first active entry wins */
+			{
+				t = LED_STACK[i][k][1];
+				break;
+			}
 		}
+		if( !(s&3) )
+			tab[s>>2] = 0;
+		tab[s>>2] |= t<<((s&3)<<1);
 	}
-	
-	ret = 0xff; /* if no bit found: return bogus bit pattern 7 source bits and "swap" set */
+}
+
+/* source map or stack of LED i changed */
+static void led_setstack( unsigned char i )
+{
+	if( !(led_ownstack & (1<<i)) )
+		led_srcmapstack( i );
+	led_buildstatetab( i );
+}
+
 
-	if( pripos >= 0 ) /* at least one bit found in source map ? */
+/* LED state (LED_IDLE,LED_ACTIVE,LED_SECONDARY,...) of LED i for given sources */
+static unsigned char led_ledstate( unsigned char i, unsigned char state )
+{
+	return ( led_statetab[i][state>>2] >> ((state&3)<<1) ) & 3;
+}
+
+
+/*
+  advance animations on a fixed time base, independent of input changes
+  and loop load, and send the LEDs that are animating (at most one burst
+  per frame, frames that find the TWI busy are caught up by the phase)
+
+  TWI traffic per animated frame (SLA+data, latch = 3 bytes):
+                     PWM (before)      current registers (now)
+   pulse, 7 LEDs:    SLA+REG+42+latch  SLA+REG+21+latch  47 -> 26 bytes
+   pulse, 1 LED:     SLA+REG+6+latch   SLA+REG+3+latch   11 ->  8 bytes
+   dim, all LEDs:    SLA+REG+42+latch  SLA+REG+1          47 ->  3 bytes
+  and no color recomputation for pulsing LEDs.
+  Queued per frame: global current, scaling registers, PWM values and
+  one latch for both.
+*/
+void led_animate( void )
+{
+	unsigned char i,m,s,*tcmd;
+	uint16_t inc,err;
+
+	twi_tick(); /* bus timeout, statistics */
+	err = twi_geterrors();
+	if( led_twierrors != err )
+	{
+		/* a transfer was lost: rewrite everything */
+		led_twierrors  = err;
+		led_pwmforce   = 1;
+		led_scaleforce = 1;
+		led_gcc        = ~led_gccnext;
+		led_animdirty  = (1<<N_LED)-1;
+	}
+
+	if( led_framediv )
+		led_framediv--;
+	else
 	{
-		/* secondary is upper bit ? */
-		if( srcmap & 0x80 )
+		led_framediv = LED_FRAMEDIV-1;
+
+		for( i=0 ; i < N_LED ; i++ )
 		{
-			/* (sec > pri) or pri inactive */
-			if( secpos >= 0 )
-				pripos = secpos;
-			/* secondary is either the only source bit (pripos) or 
-			   the higher bit (from secpos) */
-			ret = 0x80 | (1<<pripos);
+			if( led_fading & (1<<i) )
+			{
+				if( (uint16_t)(0xFFFF - led_fadepos[i]) <= led_fadestep[i] )
+					led_fading &= ~(1<<i); /* done, last frame shows target */
+				else	led_fadepos[i] += led_fadestep[i];
+				led_animdirty |= (1<<i);
+			}
+
+			m = LED_MODES[i] & LEDM_MASK;
+			if( (m == LEDM_STATIC) || (m == LEDM_ACTIVITY) || (m == LEDM_CANVAS) )
+				continue;
+			if( m >= LEDM_NMODES )
+				m = LEDM_SAT; /* see led_computepwm() */
+
+			s = LED_MODES[i] >> LEDM_SPEEDSHIFT;
+			inc = (s) ? ((uint16_t)s<<6) : pgm_read_word( &led_modespeed[m] );
+			led_phase[i] += inc;
+
+			s = led_phase[i]>>8;
+			if( s != LED_MODESTATE[i] )
+			{
+				LED_MODESTATE[i] = s;
+				if( m != LEDM_PULSE ) /* pulse: scaling registers only */
+					led_animdirty |= (1<<i);
+			}
 		}
-		else
+
+		led_actframe();
+		for( i=0 ; i < N_LED ; i++ )
+			led_computescale( i );
+
+		/* idle time, dim down one step per frame, wake up at once */
+		if( ++led_idleframes >= LED_FPM )
+		{
+			led_idleframes = 0;
+			if( led_idlemin < 255 )
+				led_idlemin++;
+		}
+		s = led_dimtarget();
+		if( s < led_gccnext )
+			led_gccnext--;
+		else	led_gccnext = s;
+	}
+
+	/* room for global current, scaling, PWM and latch */
+	if( twi_queuefree() < 4 )
+		return;
+
+	if( led_gccnext != led_gcc )
+	{
+		led_gcc   = led_gccnext;
+		initseq[0] = LED_GCCREG;
+		initseq[1] = led_gcc;
+		twi_write(I2CADDRESS, initseq, 2, (0) );
+	}
+
+	led_sendrange( LED_SCALEREG, led_scale, led_scalenew, LED_SCALEBYTES, led_scaleforce );
+	led_scaleforce = 0;
+
+	if( !led_animdirty )
+	{
+		led_latch();
+		return;
+	}
+
+	tcmd = twicmds;
+	for( i=0 ; i < N_LED ; i++ )
+	{
+		if( led_animdirty & (1<<i) )
 		{
-			/* secondary is the lower bit (if both sources are active) */
-			if( secpos >= 0 )
-				ret = (1<<pripos); /* pripos was checked above */
+			*tcmd++ = i;
+			*tcmd++ = led_ledstate( i, src_active );
 		}
 	}
+	*tcmd++ = TCMD_END;
+	*tcmd++ = TCMD_END;
+	led_animdirty = 0;
+
+	twi_ledupdate_pos = 0;
+	led_sendframe();
+	led_latch();
+}
 
-	return ret;
+
+void led_forceupdate( void )
+{
+	led_force = 1;
+}
+
+unsigned char led_canvasmask( void )
+{
+	unsigned char i,mask = 0;
+
+	for( i=0 ; i < N_LED ; i++ )
+	{
+		if( (LED_MODES[i] & LEDM_MASK) == LEDM_CANVAS )
+			mask |= (1<<i);
+	}
+	return mask;
 }
 
+/* the strip effect rendered a new frame: canvas LEDs are sent with the
+   next led_animate() (same tick, see main loop) */
+void led_canvasframe( void )
+{
+	led_animdirty |= led_canvasmask();
+}
 
 /* apply input state to LEDs */
 unsigned char led_updatecontroller( unsigned char state )
 {
-	unsigned char chg,*tcmd,i,t,q;
+	unsigned char chg,*tcmd,i,q;
 
-	chg = src_active^state; /* changed inputs */
+	chg = (led_force) ? LEDF_ALLSTACK : src_active^state; /* changed inputs */
 	if( !chg )
 		return state;
-	if( twi_isbusy() )
-		return state;
-	if( led_sending )
+	if( twi_queuefree() < 2 ) /* burst and latch, else retry in next call */
 		return state;
 
-	if( state & LED_FORCE_UPDATE )
-		chg = LEDF_ALL; /* force all changed */
-	state &= LEDF_ALL;
+	if( led_force )
+		led_pwmforce = 1; /* re-send all PWM registers */
 	/* traverse LEDs and issue commands into TWI wait queue
 	   concept: write LED index and state into command buffer,
-	            which is translated into TWI sequences in it's
-		    write callback (plus "confirm" command)
+	            which is translated into one TWI burst by
+		    led_sendframe() (plus "confirm" command)
 	*/
 	tcmd = twicmds; /* generate new command list */
 
 	for( i=0 ; i < N_LED ; i++ )
 	{
 		/* does the change in sources apply to this LED? */
-		if( !( LED_SRCMAP[i] & chg ) && (chg != LEDF_ALL) )
+		if( !( led_stackmask[i] & chg ) && !led_force )
 			continue; /* no, next */
 		*tcmd++ = i; /* this LED needs new RGB */
-#if 1
-		t = LED_SRCMAP[i] & (state|0x80); /* get primary/secondary color from state map, decide based on srcmap what's primary, what's secondary */
-		if( LED_SECMAP[i] == t ) /* is this bit combo (exactly) the secondary condition ? */
-			q = 2;
-		else
-		{
-			q = (t&0x7f) ? 1 : 0; /* either idle or primary */
-		}
-		*tcmd++ = q; // pgm_read_byte(&prisectab[t]);
-#else
-		t = LED_SRCMAP[i] & state; /* on/off state vs. assigned bit(s) */
-		/* TODO: more states: secondary RGB */
-		if( t )
-			*tcmd++ = 1;
-		else	*tcmd++ = 0;
-#endif
+		*tcmd++ = q = led_ledstate( i, state );
+		led_startfade( i, q );
 	}
 
 	/* TODO: respect LED_MODES */
-	led_sending = 1;
 	*tcmd++ = TCMD_END;
 	*tcmd++ = TCMD_END;
 
 	twi_ledupdate_pos = 0;    /* start of list */
-	twi_ledupdate_callback(0,(0)); /* the callback will start to send the list */
+	led_sendframe();          /* compute and queue burst */
+	led_latch();
 
 	src_active = state; /* we did everything, save this state */
+	led_force  = 0;
 
 	return state;
 }
@@ -880,7 +1535,7 @@ void led_saveconfig( char neededleds )
 	unsigned char start = 0;
 	unsigned char last  = N_LED+N_LED_DIGI_CONF-1;
 	unsigned char i,k;
-	unsigned char *obuf;
+	unsigned char *obuf,*prog;
 	unsigned char *adr = (unsigned char *)0x100;
 
 	/* 
@@ -899,8 +1554,11 @@ void led_saveconfig( char neededleds )
 	obuf++;
 	eeprom_write_byte( obuf, 0x59 );
 
+	/* up to ~3.3 ms per changed byte: keep the watchdog (250 ms) quiet
+	   per block of at most 11 bytes, harmless without watchdog */
 	for( i=start ; i <= last ; i++ )
 	{
+		wdt_reset();
 		obuf = adr + 2 + i*11;
 		eeprom_update_byte( obuf++, LED_SRCMAP[i] );
 		for( k=0 ; k < LED_STATES; k++ )
@@ -912,6 +1570,59 @@ void led_saveconfig( char neededleds )
 		eeprom_update_byte( obuf++, LED_MODES[i] );
 	}
 
+	/* transition times, separate block (older firmware ignores it) */
+	wdt_reset();
+	obuf = (unsigned char *)LED_EEFADE;
+	eeprom_update_byte( obuf++, 0xBA );
+	eeprom_update_byte( obuf++, 0x46 );
+	for( i=0 ; i < N_LED ; i++ )
+		eeprom_update_byte( obuf++, LED_FADE[i] );
+
+	/* brightness, idle brightness, idle time */
+	wdt_reset();
+	obuf = (unsigned char *)LED_EEDIM;
+	eeprom_update_byte( obuf++, 0xBA );
+	eeprom_update_byte( obuf++, 0x44 );
+	for( i=0 ; i < 3 ; i++ )
+		eeprom_update_byte( obuf++, LED_DIM[i] );
+
+	/* priority stacks and 4th color */
+	obuf = (unsigned char *)LED_EESTACK;
+	eeprom_update_byte( obuf++, 0xBA );
+	eeprom_update_byte( obuf++, 0x53 );
+	eeprom_update_byte( obuf++, led_ownstack );
+	for( i=0 ; i < N_LED ; i++ )
+	{
+		wdt_reset();
+		for( k=0 ; k < LED_MAXSTACK ; k++ )
+		{
+			eeprom_update_byte( obuf++, LED_STACK[i][k][0] );
+			eeprom_update_byte( obuf++, LED_STACK[i][k][1] );
+		}
+		for( k=0 ; k < 3 ; k++ )
+			eeprom_update_byte( obuf++, LED_RGB[i][LED_TERTIARY][k] );
+	}
+
+	/* LED strip length */
+	wdt_reset();
+	obuf = (unsigned char *)LED_EESTRIP;
+	eeprom_update_byte( obuf++, 0xBA );
+	eeprom_update_byte( obuf++, 0x4C );
+	eeprom_update_byte( obuf++, led_digital_getlength() );
+
+	/* LED strip effect program */
+	obuf = (unsigned char *)LED_EEPROG;
+	eeprom_update_byte( obuf++, 0xBA );
+	eeprom_update_byte( obuf++, 0x50 );
+	k = led_digital_getprog( &prog );
+	eeprom_update_byte( obuf++, k );
+	for( i=0 ; i < k ; i++ )
+	{
+		if( !(i & 15) )
+			wdt_reset(); /* 16 bytes: ~53 ms */
+		eeprom_update_byte( obuf++, prog[i] );
+	}
+
 	obuf = adr;
 	eeprom_update_byte( obuf, 0xBA );
 	obuf++;
@@ -984,7 +1695,6 @@ void led_loadconfig( char neededleds )
 		obuf = adr + 2 + i*11;
 
 		LED_SRCMAP[i] = eeprom_read_byte( obuf++ );
-		LED_SECMAP[i] = get_secmap(LED_SRCMAP[i]); /* bit combinations (including SWAP flag) for secondary function */
 
 		for( k=0 ; k < LED_STATES; k++ )
 		{
@@ -995,6 +1705,63 @@ void led_loadconfig( char neededleds )
 
 		LED_MODES[i]  = eeprom_read_byte( obuf++ );
 	}
+
+	/* transition times, if present */
+	obuf = (unsigned char *)LED_EEFADE;
+	if( (eeprom_read_byte( obuf ) == 0xBA) && (eeprom_read_byte( obuf+1 ) == 0x46) )
+	{
+		obuf += 2;
+		for( i=0 ; i < N_LED ; i++ )
+			LED_FADE[i] = eeprom_read_byte( obuf++ );
+	}
+
+	/* brightness settings, if present */
+	obuf = (unsigned char *)LED_EEDIM;
+	if( (eeprom_read_byte( obuf ) == 0xBA) && (eeprom_read_byte( obuf+1 ) == 0x44) )
+	{
+		obuf += 2;
+		for( i=0 ; i < 3 ; i++ )
+			LED_DIM[i] = eeprom_read_byte( obuf++ );
+	}
+
+	/* priority stacks, if present */
+	obuf = (unsigned char *)LED_EESTACK;
+	if( (eeprom_read_byte( obuf ) == 0xBA) && (eeprom_read_byte( obuf+1 ) == 0x53) )
+	{
+		obuf += 2;
+		led_ownstack = eeprom_read_byte( obuf++ );
+		for( i=0 ; i < N_LED ; i++ )
+		{
+			for( k=0 ; k < LED_MAXSTACK ; k++ )
+			{
+				LED_STACK[i][k][0] = eeprom_read_byte( obuf++ ) & LEDF_ALLSTACK;
+				LED_STACK[i][k][1] = eeprom_read_byte( obuf++ ) & (LED_NSTATES-1);
+			}
+			for( k=0 ; k < 3 ; k++ )
+				LED_RGB[i][LED_TERTIARY][k] = eeprom_read_byte( obuf++ );
+		}
+	}
+
+	/* LED strip length, if present */
+	obuf = (unsigned char *)LED_EESTRIP;
+	if( (eeprom_read_byte( obuf ) == 0xBA) && (eeprom_read_byte( obuf+1 ) == 0x4C) )
+		led_digital_setlength( eeprom_read_byte( obuf+2 ) );
+
+	/* LED strip effect program, if present */
+	obuf = (unsigned char *)LED_EEPROG;
+	if( (eeprom_read_byte( obuf ) == 0xBA) && (eeprom_read_byte( obuf+1 ) == 0x50) )
+	{
+		unsigned char prog[LEDD_PROGMAX];
+
+		k = eeprom_read_byte( obuf+2 );
+		if( k <= LEDD_PROGMAX )
+		{
+			eeprom_read_block( prog, obuf+3, k );
+			led_digital_setprog( prog, k );
+		}
+	}
+	for( i=0 ; i < N_LED ; i++ )
+		led_setstack( i );
 }
 
 
@@ -1022,13 +1789,23 @@ void led_defaults()
 
 	LED_SRCMAP[6] = LEDF_SRC_CAPS;
 
-	for( i=0 ; i < 7 ; i++ )
-		LED_SECMAP[i] = get_secmap(LED_SRCMAP[i]); /* bit combinations (including SWAP flag) for secondary function */
+	led_ownstack = 0; /* stacks follow LED_SRCMAP */
 	for( i=0 ; i < N_LED ; i++ )
 	{
+		led_setstack( i );
+		LED_RGB[i][LED_TERTIARY][0] = 0;
+		LED_RGB[i][LED_TERTIARY][1] = 0;
+		LED_RGB[i][LED_TERTIARY][2] = 0;
 		LED_MODES[i] = 0;
 		LED_MODESTATE[i] = 0;
+		led_phase[i] = 0;
+		LED_FADE[i] = 0; /* instant state changes */
 	}
+	LED_DIM[0] = 0xff; /* full brightness */
+	LED_DIM[1] = 0xff;
+	LED_DIM[2] = 0;    /* no idle dimming */
+	led_digital_setlength( N_DIGI_LED );
+	led_digital_setprog( NULL, 0 );
 
 	/* RGB defaults */
 	for( i=0 ; i < 3 ; i++ )
@@ -1102,8 +1879,10 @@ void led_init()
   unsigned char i,j;
 
   led_currentstate = 0; /* all off/idle */
-  adc_cycle = 0;
+  adc_state = 0;
+  adc_ch = 0;
   src_active = 0;       /* source state as sent to LEDs  */
+  led_pwmforce = 1;     /* PWM shadow unknown */
 
   /* LED sources */
   DRVLED_DDR  &= ~(1<<DRVLED_BIT);
@@ -1118,8 +1897,10 @@ void led_init()
   PLED_DDR    &=  ~(1<<PLED_BIT);
   PLED_PORT   &=  ~(1<<PLED_BIT); /* we use this as analog input */
 
-  ADCSRA = 0x87;                  /* Enable ADC, fr/128  */
-  ADMUX  = 0x40;                  /* Vref: Avcc, ADC channel: 0 (PortF on AT90USB1287 */
+  DIDR0  = 0x03;                  /* ADC0, ADC1: no digital input buffer */
+  ADMUX  = 0x60;                  /* Vref: Avcc, left adjusted (8 bit in ADCH), ADC channel: 0 (PortF on AT90USB1287 */
+  ADCSRB = 0;                     /* auto trigger: free running */
+  ADCSRA = (1<<ADEN)|(1<<ADSC)|(1<<ADATE)|(1<<ADIE)|0x07; /* Enable ADC, start, free running, interrupt, fr/128 */
 
 #if 0
   /* ADC test */
@@ -1164,15 +1945,11 @@ void led_init()
 		twi_write(I2CADDRESS, initseq, i, NULL );
 	};
 
-	/* RGB balance (white balance) */
-  	for( i=0 ; i < 21 ; i+=3 ) /* 21 outputs for 7 LEDs used */
-  	{
-		initseq[0] = 0x4A + i; /* target register */ 
-		initseq[1] = 0xFF;     /* R */ 
-		initseq[2] = 0xFF;     /* G */ 
-		initseq[3] = 0x5F;     /* B */
-		twi_write(I2CADDRESS, initseq, 4, NULL );
-	}
+	/* RGB balance (white balance), 21 outputs for 7 LEDs used, one burst */
+  	for( i=0 ; i < LED_SCALEBYTES ; i++ )
+		led_scale[i] = led_scalenew[1+i] = pgm_read_byte(&led_balance[i%3]);
+	led_scalenew[0] = LED_SCALEREG; /* target register */
+	twi_write(I2CADDRESS, led_scalenew, LED_SCALEBYTES+1, NULL );
 
 	/* set RGB defaults and input port assignments */
 	led_defaults();
@@ -1180,6 +1957,13 @@ void led_init()
 	/* load config from EEPROM, if present */
 	led_loadconfig( 0x7f );
 
+	/* configured brightness (Global Current Control, 0x1-0xFF) */
+	led_activity();
+	led_gcc = led_gccnext = led_dimtarget();
+	initseq[0] = LED_GCCREG;
+	initseq[1] = led_gcc;
+	twi_write(I2CADDRESS, initseq, 2, NULL );
+
 	/* write some RGB values */
 #if 0
 	i=0;
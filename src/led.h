@@ -16,6 +16,12 @@ uint8_t led_setinputstate( uint8_t source, uint8_t state );
 /* update controller based on input state */
 unsigned char led_updatecontroller( unsigned char state );
 
+/* animation engine, call on every timer 2 overflow (16.3 ms) */
+void led_animate( void );
+
+/* key activity (restarts idle time of LEDX_SETDIM) */
+void led_activity( void );
+
 /* save current configuration */
 void led_saveconfig( char );
 
@@ -27,15 +33,32 @@ void led_saveconfig( char );
 */
 char led_putcommands( unsigned char *recvcmd, unsigned char nrecv );
 
+/* source change notification for host (when enabled by LEDX_NOTIFY) 
+
+   returns: 0 = nothing to report
+           else state|0x80 to be sent after COMM_NOTIFY, with the
+	   hardware sources in bits 0-4 and PDIM in bit 5 (LEDN_PDIM),
+	   the virtual sources are set by the host and not reported
+*/
+unsigned char led_notifystate( unsigned char state );
+void led_setnotify( unsigned char on );
+
 void HSV2RGB( uint8_t *rgb, int16_t h, int16_t s, int16_t v );
 void RGB2HSV( int16_t *hsv, uint8_t r, uint8_t g, uint8_t b );
 
 
+/* CRC16 (CCITT, init 0xFFFF) across the GETCONFIG records of all LEDs */
+uint16_t led_configcrc( void );
+
 unsigned char *led_getcolor( uint8_t ledidx, uint8_t state );
 unsigned char led_getmode( uint8_t ledidx );
 
-/* force flag for led_updatecontroller() */
-#define LED_FORCE_UPDATE 0x80
+/* next led_updatecontroller() re-sends all LEDs, whatever changed */
+void led_forceupdate( void );
+
+/* LEDs (bits) in LEDM_CANVAS, new canvas frame rendered (led_digital_step()) */
+unsigned char led_canvasmask( void );
+void led_canvasframe( void );
 
 /* The commands are located in the upper 3 bits */
 /* the lower 5 bits denote the LED index        */
@@ -53,11 +76,27 @@ unsigned char led_getmode( uint8_t ledidx );
 #define LEDCMD_GETVERSION 0xA0
 /* set LED mode, 1 byte argument */
 #define LEDCMD_SETMODE    0xC0
+/* extended commands: the lower 5 bits carry a sub-command instead of an LED index */
+#define LEDCMD_EXT        0xE0
+
+/* sub-commands of LEDCMD_EXT */
+#define LEDX_GETCRC       0x00 /* get CRC16 of active LED config (no argument), returns 0xBA,CRC_H,CRC_L */
+#define LEDX_SETVSRC      0x04 /* set virtual sources (no argument), state in lower 2 bits: 0x04...0x07 */
+#define LEDX_VSRC_MASK    0x03
+#define LEDX_FRAME        0x08 /* LED strip frame: 1 byte length, then frame opcodes (see led_digital.h) */
+#define LEDX_NOTIFY       0x0A /* source change notifications (no argument), 0x0A = off, 0x0B = on */
+#define LEDX_SETFADE      0x0C /* state transition time: 1 byte LED (0xFF = all), 1 byte time in frames (33ms, 0 = instant) */
+#define LEDX_SETDIM       0x0D /* brightness: 1 byte brightness, 1 byte idle brightness (0...255), 1 byte idle time in minutes (0 = never) */
+#define LEDX_SETSTACK     0x0E /* priority stack: 1 byte LED, 1 byte N (0...4, 0 = back to source map), N * (source mask, state) */
+#define LEDX_SETSTRIP     0x0F /* LED strip length: 1 byte number of LEDs (1...LEDD_MAXLED, 0 = default) */
+#define LEDX_STRIPNOTE    0x10 /* LED strip notification layer: 1 byte alpha (0 = off), R,G,B, 1 byte fade out time in frames (0 = hold) */
+#define LEDX_SETPROG      0x11 /* LED strip effect program: 1 byte length (0...LEDD_PROGMAX, even), then bytecode (see led_digital.h), stored in EEPROM,
+                                  returns 0xBA,1 = accepted (0 = rejected),length of the active program */
 
 /* Please note that the protocol is designed for short packets to avoid
    overflows in send/receive buffers. As a consequence, only one command
    with return values (from Keyboard to Amiga) may be issued at a time.
-   This limitation concerns LEDCMD_GETVERSÌON, LEDCMD_GETCONFIG and
+   This limitation concerns LEDCMD_GETVERSÌON, LEDCMD_GETCONFIG, LEDX_GETCRC, LEDX_SETPROG and
    LEDCMD_SAVECONFIG (asynchronous EEPROM write, where the command is
    acknowledged first and some seconds take place for the writes itself). 
    Use only one of these commands at a time.
@@ -68,11 +107,12 @@ unsigned char led_getmode( uint8_t ledidx );
 #define LEDGV_TYPE_A500  0x01 /* 7 LEDs */
 #define LEDGV_TYPE_A3000 0x02 /* 1 LED only */
 #define LEDGV_TYPE_A500Mini 0x03 /* 6 LEDs, no CAPS */
-#define LEDGV_VERSION    0x0A /* software version (1=initial, 2=with mode support, 3=mini added, 4=USB added) */
+#define LEDGV_VERSION    0x0C /* software version (1=initial, 2=with mode support, 3=mini added, 4=USB added) */
                               /* 5=DigitalLED added, also: even numbers > 4 = no digi LED, odd numbers = digi LED
 			         6=DigitalLED capable but not enabled
 				 8=Watchdog added, DigitalLED capable
 				 10=reverted to 16 MHz, some code optimization
+				 12=LEDCMD_EXT: config CRC, virtual sources, notifications
 			      */
 
 /* LED MODES */
@@ -80,6 +120,13 @@ unsigned char led_getmode( uint8_t ledidx );
 #define LEDM_RAINBOW 1	/* HSV rainbow */
 #define LEDM_PULSE   2  /* Pulsation   */
 #define LEDM_SAT     3  /* Saturation up/down */
+#define LEDM_ACTIVITY 4 /* brightness follows activity of FLOPPY/IN3/IN4 */
+#define LEDM_CANVAS  5  /* idle color from the strip effect (LED = canvas pixel in front of the strip) */
+#define LEDM_NMODES  6
+/* mode byte of the analog LEDs: mode in lower bits, animation speed
+   in upper bits (0 = default speed of mode, 1...15 = slow...fast) */
+#define LEDM_MASK       0x0f
+#define LEDM_SPEEDSHIFT 4
 
 /* LED Sources as flags used for state and change tracking */
 #define LEDB_SRC_POWER  0
@@ -87,12 +134,23 @@ unsigned char led_getmode( uint8_t ledidx );
 #define LEDB_SRC_IN3    2
 #define LEDB_SRC_IN4    3
 #define LEDB_SRC_CAPS   4
+#define LEDB_SRC_VIRT1  5 /* virtual sources, set by host (LEDX_SETVSRC) */
+#define LEDB_SRC_VIRT2  6
 #define LEDF_SRC_POWER  (1<<LEDB_SRC_POWER)
 #define LEDF_SRC_FLOPPY (1<<LEDB_SRC_FLOPPY)
 #define LEDF_SRC_IN3    (1<<LEDB_SRC_IN3)
 #define LEDF_SRC_IN4    (1<<LEDB_SRC_IN4)
 #define LEDF_SRC_CAPS   (1<<LEDB_SRC_CAPS)
-#define LEDF_ALL ( (LEDF_SRC_POWER)|(LEDF_SRC_FLOPPY)|(LEDF_SRC_IN3)|(LEDF_SRC_IN4)|(LEDF_SRC_CAPS) )
+#define LEDF_SRC_VIRT1  (1<<LEDB_SRC_VIRT1)
+#define LEDF_SRC_VIRT2  (1<<LEDB_SRC_VIRT2)
+#define LEDF_SRC_VIRT   ( (LEDF_SRC_VIRT1)|(LEDF_SRC_VIRT2) )
+#define LEDF_ALL ( (LEDF_SRC_POWER)|(LEDF_SRC_FLOPPY)|(LEDF_SRC_IN3)|(LEDF_SRC_IN4)|(LEDF_SRC_CAPS)|(LEDF_SRC_VIRT) )
+/* power LED dimmed (A500: audio filter off), POWER is bright only;
+   bit 7 of the source map is the swap flag, so priority stacks only */
+#define LEDB_SRC_PDIM   7
+#define LEDF_SRC_PDIM   (1<<LEDB_SRC_PDIM)
+#define LEDF_ALLSTACK ( (LEDF_ALL)|(LEDF_SRC_PDIM) )
+#define LEDN_PDIM       (1<<LEDB_SRC_VIRT1) /* PDIM in source change notifications */
 #define LEDB_MAP_SWAP	7
 #define LEDF_MAP_SWAP	(1<<LEDB_MAP_SWAP)
 
@@ -102,7 +160,9 @@ unsigned char led_getmode( uint8_t ledidx );
 #define LED_IDLE      0 /* idle             */
 #define LED_ACTIVE    1 /* primary   active */
 #define LED_SECONDARY 2 /* secondary active */
-#define LED_STATES    3 
+#define LED_STATES    3 /* states in config records (GETCONFIG, CRC, EEPROM) */
+#define LED_TERTIARY  3 /* 4th state, only reachable by LEDX_SETSTACK */
+#define LED_NSTATES   4 /* states with a color (LEDCMD_COLOR) */
 
 
 /* number of LEDs */
@@ -22,6 +22,17 @@
   - saturation
 
   - splash (white in currently pressed column, then fade to static color)
+  - program (bytecode from the host, stored in EEPROM, see LED_vm_pixel())
+
+ layers (see LED_composite()):
+  - base:     one of the modes above or a frame streamed by the host
+  - reactive: splash of pressed keys, white, saturating add
+              (splash mode: on static color, LEDD_FXREACT: on any mode)
+  - notify:   color from the host (LEDX_STRIPNOTE), crossfade with alpha
+
+ canvas: the modes render across the analog LEDs (in front, LED 0...N_LED-1)
+ and the strip as soon as one analog LED is in mode LEDM_CANVAS, led.c takes
+ its pixels through led_digital_canvas() (same gamma table on both sides)
 
 */
 #define LEDD_FX_STATIC     0
@@ -32,8 +43,11 @@
 #define LEDD_FX_KITT       5
 
 #define LEDD_FX_SPLASH     6
+#define LEDD_FX_PROG       7
 #define LEDD_FXMASK        0xF
 #define LEDD_FXRGB         0x20
+#define LEDD_FXREACT       0x40 /* splash of pressed keys on top of any mode */
+#define LEDD_REACTIVE( _m_ ) ( ((_m_) & LEDD_FXREACT) || (((_m_) & LEDD_FXMASK) == LEDD_FX_SPLASH) )
 
 #define LEDD_STATE LED_ACTIVE
 
@@ -45,8 +59,12 @@
 
 /* full brightness = 31 */
 /* half brightness = 15 */
-#define LEDD_PREAMBLE (0xE0+7)
-//#define LEDD_PREAMBLE (0xE0+31)
+/* brightness cap: the global brightness per pixel goes 1...LEDD_GBMAX,
+   see LEDD_PH_WIRE in led_digital_poll() */
+#define LEDD_GBMAX 7
+//#define LEDD_GBMAX 31
+/* temporal dither of the PWM fraction (16 frames), off: rounded */
+//#define LEDD_DITHER
 
 #include <avr/interrupt.h>
 #include <avr/pgmspace.h>
@@ -70,11 +88,17 @@
 void LED_Start_Frame();
 void LED_Stop_Frame( unsigned char nled );
 
-unsigned char LED_update_dot( unsigned char ledd_cur, unsigned char rgbmode );
-unsigned char LED_update_rainbow( unsigned char pos, unsigned char spd, unsigned char rgbmode  );
-unsigned char LED_update_saturation( unsigned char pos, unsigned char spd, unsigned char rgbmode  );
-unsigned char LED_update_kitt( unsigned char pos, unsigned char rgbmode );
-unsigned char LED_update_splash( unsigned char ledd_cur, unsigned char rgbmode );
+void LED_output( unsigned char *p, unsigned char rgbmode );
+unsigned char LED_update_dot( unsigned char ledd_cur );
+unsigned char LED_update_rainbow( unsigned char pos, unsigned char spd );
+unsigned char LED_update_saturation( unsigned char pos, unsigned char spd );
+unsigned char LED_update_kitt( unsigned char pos );
+unsigned char LED_update_splash( void );
+void LED_compose( unsigned char *base, unsigned char rgbmode );
+static void LED_composite( unsigned char pos, unsigned char end );
+static void LED_frameout( unsigned char rgbmode );
+static unsigned char LED_vm_pixel( unsigned char i );
+static void LED_canvasgeom( void );
 
 /* actual update rate */
 #if (F_CPU == 8000000 )
@@ -85,17 +109,97 @@ unsigned char LED_update_splash( unsigned char ledd_cur, unsigned char rgbmode )
 
 unsigned char ledd_cur = 0;
 unsigned char ledd_dly = LED_DELAY;
-unsigned char ledd_fxstate[N_DIGI_LED]; /* private to active fx */
-unsigned char ledd_fxkeycolstate[N_DIGI_LED]; /* counter for active keys per column */
+unsigned char ledd_fxstate[LEDD_MAXLED]; /* private to active fx */
+unsigned char ledd_fxkeycolstate[N_DIGI_COL]; /* counter for active keys per column */
+unsigned char ledd_splstate[N_DIGI_COL];      /* splash animation step per column */
+
+/* strip length and what depends on it (see led_digital_setlength()) */
+unsigned char ledd_n = N_DIGI_LED;
+unsigned char ledd_npre;                   /* analog LEDs on the canvas in front of the strip (0 or N_LED) */
+unsigned char ledd_nc = N_DIGI_LED;        /* canvas length: ledd_npre + ledd_n */
+unsigned char ledd_nkitt;                  /* LEDs of the KITT sweep (canvas) */
+unsigned char ledd_colpix[N_DIGI_COL+1];   /* first LED of key column, [N_DIGI_COL] = ledd_n */
+uint16_t ledd_dscale;                      /* LED distance to splash kernel distance, 8.8 */
+unsigned char ledd_splreach;               /* LED distance beyond the splash kernel */
+unsigned char ledd_add[LEDD_MAXLED];       /* splash: coverage of the reactive layer per LED */
+
+/* splashes of the current frame (see LED_update_splash()) */
+unsigned char ledd_nspl;
+unsigned char ledd_splctr[N_DIGI_COL];     /* center LED */
+const unsigned char *ledd_splkern[N_DIGI_COL]; /* kernel of the animation step (PROGMEM) */
+uint16_t ledd_splkey;                      /* key columns held down (bit per column) */
+
+/* streamed frames: double buffer, the back buffer is a copy of the
+   front buffer after each swap, so that host frames can be deltas */
+#define LEDD_STREAM_TIMEOUT 255 /* steps without frame -> back to effects (~8s) */
+unsigned char ledd_frame[2][LEDD_MAXLED][3];
+unsigned char ledd_palette[LEDD_NPAL][3];
+unsigned char ledd_front;     /* displayed buffer */
+unsigned char ledd_framepend; /* back buffer complete */
+unsigned char ledd_stream;    /* >0: streaming active (timeout counter) */
+
+unsigned char ledd_pix[N_LED+LEDD_MAXLED][3]; /* effect output (canvas, base layer of strip), R,G,B per LED */
+unsigned char ledd_out[LEDD_MAXLED][3]; /* base with overlays */
+unsigned char *ledd_base = &ledd_pix[0][0]; /* base layer of the current frame */
+
+/* overlay layers, in order */
+struct ledd_layer {
+	unsigned char *cov;   /* coverage per LED (0...255), NULL = whole strip */
+	unsigned char rgb[3];
+	unsigned char alpha;  /* opacity, 0 = layer off */
+	unsigned char blend;  /* LEDD_BLEND_ADD or LEDD_BLEND_MIX */
+};
+#define LEDD_BLEND_ADD 0 /* saturating add of alpha*rgb */
+#define LEDD_BLEND_MIX 1 /* crossfade towards rgb by alpha */
+#define LEDD_LAYER_REACT  0
+#define LEDD_LAYER_NOTIFY 1
+#define LEDD_NLAYERS      2
+struct ledd_layer ledd_layer[LEDD_NLAYERS] = {
+	{ ledd_add, { 0xff, 0xff, 0xf1 }, 0, LEDD_BLEND_ADD },
+	{ NULL,     { 0, 0, 0 },          0, LEDD_BLEND_MIX }
+};
+uint16_t ledd_nalpha; /* notify: opacity 8.8, fades by ledd_nstep per frame */
+uint16_t ledd_nstep;
+
+/* effect program (LEDX_SETPROG), opcodes in led_digital.h */
+unsigned char ledd_prog[LEDD_PROGMAX];
+unsigned char ledd_proglen;  /* bytes, 0 = none */
+unsigned char ledd_vmframe;  /* frame counter, register T */
+unsigned char ledd_vmpix;    /* next canvas pixel of the frame */
+unsigned char ledd_vmrgb;    /* color order of the frame */
+unsigned char *ledd_vmcol;   /* strip color, registers CR,CG,CB */
+uint16_t ledd_vmbudget;      /* instructions left in this frame */
+
+/* wire image of one strip frame: start frame, 4 bytes per LED, end frames
+   (see LED_Stop_Frame()), sent by LCD_SPI_Send() in one go */
+#define LEDD_WIREBYTES (4+LEDD_MAXLED*4+4+LEDD_MAXLED/8+1)
+unsigned char ledd_wire[LEDD_WIREBYTES];
+unsigned char *ledd_wp;
+#define LEDD_OUT( _a_ ) *ledd_wp++ = (_a_)
+
+/* output of the wire image in slices, see led_digital_poll() */
+#define LEDD_PH_IDLE 0
+#define LEDD_PH_HASH 1
+#define LEDD_PH_WIRE 2
+#define LEDD_PH_SEND 3
+#define LEDD_PH_VM   4 /* effect program, before hash */
+#define LEDD_PH_COMP 5 /* overlays, before hash */
+unsigned char ledd_phase;
+
+/* key event in splash mode: one frame right away (from led_digital_poll()),
+   at most one per timer tick, without advancing the splash animation */
+unsigned char ledd_kick;    /* 1 = key event, frame wanted */
+unsigned char ledd_kickok;  /* 1 = immediate frame allowed in this tick */
+unsigned char ledd_still;   /* 1 = render current splash step again */
 
 
 void led_digital_updown(unsigned char code, unsigned char leftright)
 {
 	/* restrict logic to relevant mode(s) */
-	if( (led_getmode( IDX_LED_DIGI ) & LEDD_FXMASK) != LEDD_FX_SPLASH )
+	if( !LEDD_REACTIVE( led_getmode( IDX_LED_DIGI ) ) )
 		return;
 
-	if( leftright >= N_DIGI_LED )
+	if( leftright >= N_DIGI_COL )
 		return;
 
 	if( code & 128 ) /* code & ( (!KEYDOWN)<<7 ) */
@@ -108,8 +212,97 @@ void led_digital_updown(unsigned char code, unsigned char leftright)
 	{
 		/* KEYDOWN */
 		ledd_fxkeycolstate[leftright] += 1;
-		ledd_fxstate[leftright] = LEDD_SPLASH_INIT;
+		ledd_splstate[leftright] = LEDD_SPLASH_INIT;
+	}
+	ledd_kick = 1;
+}
+
+
+/*
+  notification layer: crossfade of the whole strip towards r,g,b with
+  opacity alpha, fading out over the given number of frames (0 = hold,
+  alpha 0 = off)
+*/
+void led_digital_notify( unsigned char alpha, unsigned char r, unsigned char g, unsigned char b, unsigned char frames )
+{
+ struct ledd_layer *l = &ledd_layer[LEDD_LAYER_NOTIFY];
+
+ l->rgb[0]   = r;
+ l->rgb[1]   = g;
+ l->rgb[2]   = b;
+ l->alpha    = alpha;
+ ledd_nalpha = (uint16_t)alpha<<8;
+ ledd_nstep  = (frames) ? ledd_nalpha / frames : 0;
+}
+
+
+/* decode frame opcodes into the back buffer
+
+   A frame that arrives before the previous one was shown just
+   continues on the same back buffer (the host sends deltas against
+   its last frame, not against the displayed one).
+*/
+void led_digital_putframe( unsigned char *buf, unsigned char n )
+{
+ unsigned char op,cnt,pos,*dst,*src;
+
+ pos = 0;
+ while( n-- )
+ {
+	op = *buf++;
+	if( op & LEDD_OP_RUN )
+	{
+		cnt = ((op>>4)&7)+1;
+		src = ledd_palette[op&0xF];
+		while( (cnt--) && (pos < ledd_n) )
+		{
+			dst = ledd_frame[ledd_front^1][pos++];
+			dst[0] = src[0];
+			dst[1] = src[1];
+			dst[2] = src[2];
+		}
+	}
+	else if( op & LEDD_OP_SKIP )
+	{
+		if( pos < ledd_n ) /* no wrap-around on bogus input */
+			pos += (op&0x3F)+1;
+	}
+	else if( (op & 0xF0) == LEDD_OP_PAL )
+	{
+		if( n < 3 )
+			break;
+		n -= 3;
+		dst = ledd_palette[op&0xF];
+		*dst++ = *buf++;
+		*dst++ = *buf++;
+		*dst++ = *buf++;
+	}
+	else if( op == LEDD_OP_RGB )
+	{
+		if( n < 3 )
+			break;
+		n -= 3;
+		if( pos < ledd_n )
+		{
+			dst = ledd_frame[ledd_front^1][pos];
+			dst[0] = buf[0];
+			dst[1] = buf[1];
+			dst[2] = buf[2];
+		}
+		buf += 3;
+		pos++;
 	}
+	else if( op == LEDD_OP_OFF )
+	{
+		ledd_stream    = 0;
+		ledd_framepend = 0;
+		return;
+	}
+	else	break; /* unknown opcode: ignore rest */
+ }
+
+ ledd_framepend = 1;
+ ledd_stream    = LEDD_STREAM_TIMEOUT;
 }
 
 
@@ -117,13 +310,13 @@ void led_digital_updown(unsigned char code, unsigned char leftright)
 char led_digital_step()
 {
  unsigned char fx = LEDD_FX_RAINBOWSLW; //LEDD_FX_SATURATION;//LEDD_FX_KITT; //LEDD_FX_RAINBOWSLW; //LEDD_FX_DOT;
- unsigned char rgbmode;
+ unsigned char rgbmode,m,pre;
 
- fx = led_getmode( IDX_LED_DIGI );
- rgbmode = (fx & LEDD_FXRGB) ? 1 : 0;
- fx &= LEDD_FXMASK;
+ m  = led_getmode( IDX_LED_DIGI );
+ rgbmode = (m & LEDD_FXRGB) ? 1 : 0;
+ fx = m & LEDD_FXMASK;
 
-// { unsigned char *rgb = led_getcolor( IDX_LED_DIGI, LEDD_STATE );
+ ledd_kickok = 1; /* next key event may show at once */
 
 #if (LED_DELAY > 0)
  /* global update interval ( 15.2ms*(1+LED_DELAY) ) */
@@ -132,57 +325,368 @@ char led_digital_step()
  	ledd_dly--;
 	return 0;
  }
+#endif
+ /* previous frame still on its way: next time */
+ if( (ledd_phase != LEDD_PH_IDLE) || LCD_SPI_Busy() )
+	return 0;
+#if (LED_DELAY > 0)
  ledd_dly = LED_DELAY;
 #endif
+ ledd_kick = 0; /* this frame shows pending key events */
+
+ /* overlays: reactive layer follows the keys, notification fades out */
+ ledd_layer[LEDD_LAYER_REACT].alpha = ( LEDD_REACTIVE( m ) && LED_update_splash() ) ? 255 : 0;
+ if( ledd_nstep )
+ {
+	ledd_nalpha = ( ledd_nalpha > ledd_nstep ) ? ledd_nalpha - ledd_nstep : 0;
+	ledd_layer[LEDD_LAYER_NOTIFY].alpha = ledd_nalpha>>8;
+	if( !ledd_nalpha )
+		ledd_nstep = 0;
+ }
 
- /* start update cycle */
- LED_Start_Frame();
+ /* analog LEDs joined or left the canvas */
+ pre = ( led_canvasmask() ) ? N_LED : 0;
+ if( pre != ledd_npre )
+ {
+	ledd_npre = pre;
+	LED_canvasgeom();
+ }
+
+ /* streamed frames have precedence over effects (base layer) */
+ if( ledd_stream )
+ {
+	ledd_stream--;
+	if( ledd_framepend )
+	{
+		uint16_t i;
+		unsigned char *src,*dst;
+
+		ledd_front ^= 1;
+		src = &ledd_frame[ledd_front][0][0];
+		dst = &ledd_frame[ledd_front^1][0][0];
+		for( i=0 ; i < ledd_n*3 ; i++ )
+			*dst++ = *src++;
+		ledd_framepend = 0;
+	}
+	ledd_base = &ledd_frame[ledd_front][0][0];
+	LED_compose( ledd_base, rgbmode );
+	return 0;
+ }
 
  /* TODO: more cute effects */
  switch( fx )
  {
 	case LEDD_FX_DOT:
-		ledd_cur = LED_update_dot( ledd_cur, rgbmode );break;
+		ledd_cur = LED_update_dot( ledd_cur );break;
 	case LEDD_FX_RAINBOWSLW:
-		ledd_cur = LED_update_rainbow( ledd_cur, 1, rgbmode );break;
+		ledd_cur = LED_update_rainbow( ledd_cur, 1 );break;
 	case LEDD_FX_RAINBOWFST:
-		ledd_cur = LED_update_rainbow( ledd_cur, 4, rgbmode );break;
+		ledd_cur = LED_update_rainbow( ledd_cur, 4 );break;
 	case LEDD_FX_SATURATION:
-		ledd_cur = LED_update_saturation( ledd_cur, 1, rgbmode );break;
+		ledd_cur = LED_update_saturation( ledd_cur, 1 );break;
 	case LEDD_FX_KITT:
-		ledd_cur = LED_update_kitt( ledd_cur, rgbmode ); break;
-	case LEDD_FX_SPLASH:
-		ledd_cur = LED_update_splash( ledd_cur, rgbmode ); break;
-
+		ledd_cur = LED_update_kitt( ledd_cur ); break;
+	case LEDD_FX_PROG:
+		if( ledd_proglen )
+		{
+			/* program runs in slices, see led_digital_poll() */
+			ledd_vmframe++;
+			ledd_vmpix    = 0;
+			ledd_vmbudget = LEDD_VMBUDGET;
+			ledd_vmcol    = led_getcolor( IDX_LED_DIGI, LEDD_STATE );
+			ledd_vmrgb    = rgbmode;
+			ledd_phase    = LEDD_PH_VM;
+			return 0;
+		}
+		/* no program: static color */
+		/* fall through */
+	case LEDD_FX_SPLASH: /* static color, splash is the reactive layer */
  	case LEDD_FX_STATIC:
 	default:
-		ledd_cur = LED_update_dot( N_DIGI_LED, rgbmode );break;
+		ledd_cur = LED_update_dot( ledd_nc );break;
  }
 
- 
- LED_Stop_Frame(N_DIGI_LED);
-
+ LED_frameout( rgbmode );
 
  return 0;
 }
 
-#define N_KITT_LED 9
+/* canvas rendered: analog LEDs, overlays, out */
+static void LED_frameout( unsigned char rgbmode )
+{
+ if( ledd_npre )
+	led_canvasframe(); /* analog LEDs of the canvas follow in this tick */
+
+ ledd_base = &ledd_pix[ledd_npre][0];
+ LED_compose( ledd_base, rgbmode );
+}
+
+
+/*
+  frame out: hash over the pixels (and color order), the frame is only
+  sent when the hash differs from the last frame sent, or every 
+  LEDD_REFRESH frames (strip plugged in, glitch on the wires)
+
+  the color order is resolved here once per frame, the effects render
+  R,G,B
+
+  LED_output() only hands the rendered frame over, led_digital_poll()
+  works through overlays (LED_compose()), hash, wire image and transfer
+  in slices, so that a main loop pass spends at most ~100 us on them
+  (instead of several ms for a frame of 144 LEDs in one go). The next
+  frame is rendered when this one is out, i.e. the pixels stay
+  untouched meanwhile.
+
+  The effects fill the base layer on the timer tick in one go: a few
+  byte stores per pixel, at most ~0.25 ms (KITT across a canvas of 151
+  pixels), once per frame (32 ms). Everything that grows with the
+  number of keys or layers runs in the slices.
+*/
+#define LEDD_REFRESH 64 /* ~2s */
+uint16_t ledd_hash;         /* of last frame sent */
+unsigned char ledd_refresh; /* frames until the frame is sent anyway */
+
+#define LEDD_SLICE_HASH 96 /* bytes hashed per slice   (~50 us)  */
+#define LEDD_SLICE_WIRE 8  /* LEDs to wire per slice   (~100 us) */
+#define LEDD_SLICE_SEND 32 /* bytes sent per slice, software SPI (~100 us) */
+#define LEDD_SLICE_VM   48 /* program instructions per slice, whole pixels:
+                              ~110 us, up to ~330 us with HUE only (stripvm) */
+#if (LEDD_PROGMAX/2 > LEDD_SLICE_VM)
+#error "a program must fit into one VM slice"
+#endif
+#define LEDD_SLICE_COMP 40 /* overlay cost per slice, units of ~30 cycles (~80 us) */
+unsigned char ledd_compstep; /* pixels per overlay slice */
+unsigned char *ledd_src;    /* pixels of the frame on its way */
+unsigned char ledd_rgbmode;
+uint16_t ledd_pos;          /* progress within phase */
+uint16_t ledd_h;            /* hash so far */
+
+/*
+  wire image per pixel: 5 bit global brightness + 8 bit PWM
 
+  pixels are gamma corrected to 16 bit linear light (like the analog LEDs
+  in led.c), then the smallest global brightness gb that still holds the
+  brightest channel is chosen and the channels are scaled to PWM values
+  for it: pwm = lin * LEDD_GBMAX*255/gb / 65536. Dark colors get up to
+  LEDD_GBMAX*255 steps (~11 bits at 7, ~13 bits at 31) instead of 255,
+  the wire image keeps its size.
 
-unsigned char LED_update_kitt( unsigned char pos, unsigned char rgbmode )
+  ledd_gbmul[gb] = LEDD_GBMAX*255*8/gb, i.e. pwm = lin*mul >> 19
+*/
+#define LEDD_GBSHIFT 19
+#define LEDD_GBMUL( _g_ ) ( (LEDD_GBMAX*255UL*8 + ((_g_)>>1)) / (_g_) )
+const uint16_t ledd_gbmul[32] PROGMEM = {
+	0,             LEDD_GBMUL(1),  LEDD_GBMUL(2),  LEDD_GBMUL(3),
+	LEDD_GBMUL(4),  LEDD_GBMUL(5),  LEDD_GBMUL(6),  LEDD_GBMUL(7),
+	LEDD_GBMUL(8),  LEDD_GBMUL(9),  LEDD_GBMUL(10), LEDD_GBMUL(11),
+	LEDD_GBMUL(12), LEDD_GBMUL(13), LEDD_GBMUL(14), LEDD_GBMUL(15),
+	LEDD_GBMUL(16), LEDD_GBMUL(17), LEDD_GBMUL(18), LEDD_GBMUL(19),
+	LEDD_GBMUL(20), LEDD_GBMUL(21), LEDD_GBMUL(22), LEDD_GBMUL(23),
+	LEDD_GBMUL(24), LEDD_GBMUL(25), LEDD_GBMUL(26), LEDD_GBMUL(27),
+	LEDD_GBMUL(28), LEDD_GBMUL(29), LEDD_GBMUL(30), LEDD_GBMUL(31)
+};
+#ifdef LEDD_DITHER
+/* rounding offset per frame (bit reversed counter), the phase moves
+   along the strip; frames with a PWM fraction are sent even when the
+   pixels did not change, so that the average settles */
+const unsigned char ledd_dithtab[16] PROGMEM = {
+	0, 8, 4, 12, 2, 10, 6, 14, 1, 9, 5, 13, 3, 11, 7, 15
+};
+unsigned char ledd_dfrm;     /* frame counter */
+unsigned char ledd_dithpend; /* last frame had PWM fractions */
+#endif
+
+void LED_output( unsigned char *p, unsigned char rgbmode )
 {
-  unsigned char idx,r,g,b;
-//  int16_t dst;
-  unsigned char cur;//,dir;
-//  unsigned char *rgb = led_getcolor( IDX_LED_DIGI, LEDD_STATE );
+ ledd_src     = p;
+ ledd_rgbmode = rgbmode;
+ ledd_h       = rgbmode;
+ ledd_pos     = 0;
+ ledd_phase   = LEDD_PH_HASH;
+}
+
+void led_digital_poll( void )
+{
+ unsigned char n,i,gb,c[3],*p;
+ uint16_t pos,end,h,m,mul,lin[3];
+ uint32_t v,rnd;
+
+ /* key event: show it now instead of waiting for the next frame tick */
+ if( ledd_kick && ledd_kickok && (ledd_phase == LEDD_PH_IDLE) && !LCD_SPI_Busy() )
+ {
+	ledd_kick = 0;
+	n = led_getmode( IDX_LED_DIGI );
+	if( LEDD_REACTIVE( n ) )
+	{
+		/* same base, reactive layer of the current step */
+		ledd_kickok = 0;
+		ledd_still  = 1;
+		ledd_layer[LEDD_LAYER_REACT].alpha = ( LED_update_splash() ) ? 255 : 0;
+		ledd_still  = 0;
+		LED_compose( ledd_base, (n & LEDD_FXRGB) ? 1 : 0 );
+	}
+ }
+
+ pos = ledd_pos;
+ switch( ledd_phase )
+ {
+  case LEDD_PH_VM:
+	/* whole pixels, as long as the longest path still fits the slice
+	   (a program has at most LEDD_SLICE_VM instructions) */
+	for( end = 0 ; (end + (ledd_proglen>>1) <= LEDD_SLICE_VM) && (ledd_vmpix < ledd_nc) ; )
+	{
+		if( ledd_vmbudget < (ledd_proglen>>1) )
+		{
+			ledd_vmpix = ledd_nc; /* frame budget used up: rest as before */
+			break;
+		}
+		n = LED_vm_pixel( ledd_vmpix++ );
+		end += n;
+		ledd_vmbudget -= n;
+	}
+	if( ledd_vmpix < ledd_nc )
+		break;
+	LED_frameout( ledd_vmrgb );
+	pos = 0;
+	break;
+
+  case LEDD_PH_COMP:
+	end = pos + ledd_compstep;
+	if( end > ledd_n )
+		end = ledd_n;
+	LED_composite( pos, end );
+	pos = end;
+	if( pos < ledd_n )
+		break;
+	LED_output( &ledd_out[0][0], ledd_rgbmode );
+	pos = 0;
+	break;
+
+  case LEDD_PH_HASH:
+	end = ledd_n*3;
+	if( end > pos + LEDD_SLICE_HASH )
+		end = pos + LEDD_SLICE_HASH;
+	p = ledd_src + pos;
+	h = ledd_h;
+	for( ; pos < end ; pos++ )
+		h = ( (h<<3)|(h>>13) ) + *p++;
+	ledd_h = h;
+	if( pos < ledd_n*3 )
+		break;
+
+#ifdef LEDD_DITHER
+	if( (h == ledd_hash) && ledd_refresh && !ledd_dithpend )
+#else
+	if( (h == ledd_hash) && ledd_refresh )
+#endif
+	{
+		ledd_refresh--;
+		ledd_phase = LEDD_PH_IDLE; /* unchanged: nothing to send */
+		break;
+	}
+	ledd_hash    = h;
+	ledd_refresh = LEDD_REFRESH;
+
+	ledd_wp = ledd_wire;
+	LED_Start_Frame();
+#ifdef LEDD_DITHER
+	ledd_dfrm++;
+	ledd_dithpend = 0;
+#endif
+	pos = 0;
+	ledd_phase = LEDD_PH_WIRE;
+	break;
+
+  case LEDD_PH_WIRE:
+	if( ledd_rgbmode )
+	{
+		c[0] = 0; /* RBG */
+		c[1] = 2;
+		c[2] = 1;
+	}
+	else
+	{
+		c[0] = 2; /* BGR */
+		c[1] = 1;
+		c[2] = 0;
+	}
+	rnd = 1UL<<(LEDD_GBSHIFT-1);
+	p = ledd_src + pos*3;
+	for( n = LEDD_SLICE_WIRE ; n && (pos < ledd_n) ; n--, pos++, p+=3 )
+	{
+		/* gamma: table is L,H -> 16 bit little endian word */
+		m = 0;
+		for( i = 0 ; i < 3 ; i++ )
+		{
+			lin[i] = pgm_read_word( &gamma24_tableLH[p[c[i]]][GAMMATAB_L] );
+			if( lin[i] > m )
+				m = lin[i];
+		}
+
+		/* smallest global brightness for the brightest channel */
+		gb = ( (uint32_t)m * LEDD_GBMAX + 0xFFFF ) >> 16;
+		if( !gb )
+			gb = 1;
+		mul = pgm_read_word( &ledd_gbmul[gb] );
+#ifdef LEDD_DITHER
+		rnd = ( (uint32_t)pgm_read_byte( &ledd_dithtab[(ledd_dfrm+pos)&15] ) << (LEDD_GBSHIFT-4) )
+		      + (1UL<<(LEDD_GBSHIFT-5));
+#endif
+
+		/* preamble + brightness (<31 might flicker on APA102, see https://cpldcpu.com/2014/11/30/understanding-the-apa102-superled/) */
+		LEDD_OUT( 0xE0 + gb );
+		for( i = 0 ; i < 3 ; i++ )
+		{
+			v = (uint32_t)lin[i] * mul;
+#ifdef LEDD_DITHER
+			if( v & (15UL<<(LEDD_GBSHIFT-4)) )
+				ledd_dithpend = 1;
+#endif
+			v = ( v + rnd ) >> LEDD_GBSHIFT;
+			LEDD_OUT( (v > 255) ? 255 : v );
+		}
+	}
+	if( pos < ledd_n )
+		break;
+
+	LED_Stop_Frame(ledd_n);
+	pos = 0;
+	ledd_phase = LEDD_PH_SEND;
+	break;
+
+  case LEDD_PH_SEND:
+	end = ledd_wp - ledd_wire;
+#ifdef _LCD_SOFT_SPI
+	n = ( end - pos > LEDD_SLICE_SEND ) ? LEDD_SLICE_SEND : end - pos;
+	LCD_SPI_Send( ledd_wire + pos, n );
+	pos += n;
+	if( pos < end )
+		break;
+#else
+	LCD_SPI_Send( ledd_wire, end ); /* interrupt driven */
+#endif
+	ledd_phase = LEDD_PH_IDLE;
+	break;
+ }
+ ledd_pos = pos;
+}
+
+
+#define N_KITT_LED 9
+
+/* KITT sweep in N_KITT_LED steps across the first 3/5 of the canvas
+   (9 of 15 LEDs), the others keep their color */
+unsigned char LED_update_kitt( unsigned char pos )
+{
+  unsigned char idx,r,g,first,last;
+  unsigned char cur;
+  unsigned char *p;
 
 #define KITT_POSDIV 2
 
-//  dir = 0;
   cur = ( pos>>KITT_POSDIV );
   if( cur >= N_KITT_LED )
   {
-//  	dir = 1;
 	if( cur >= N_KITT_LED*2 )
 	{
 	 cur = 0;
@@ -193,10 +697,15 @@ unsigned char LED_update_kitt( unsigned char pos, unsigned char rgbmode )
   }
   pos++;
 
-  for( idx = 0 ; idx < N_KITT_LED ; idx++ )
+  /* LEDs of the current step */
+  first = ( (uint16_t)cur     * ledd_nkitt ) / N_KITT_LED;
+  last  = ( (uint16_t)(cur+1) * ledd_nkitt ) / N_KITT_LED;
+
+  p = &ledd_pix[0][0];
+  for( idx = 0 ; idx < ledd_nkitt ; idx++, p+=3 )
   {
 #define KITT_SPD 15
-   if( idx == cur )
+   if( (idx >= first) && (idx < last) )
    {
    	ledd_fxstate[idx] = 255-5-(1<<KITT_POSDIV);
    }
@@ -208,42 +717,29 @@ unsigned char LED_update_kitt( unsigned char pos, unsigned char rgbmode )
    }
 
    r = ledd_fxstate[idx] + 5; /* some background glow */
-
-   LCD_SPI( LEDD_PREAMBLE ); /* preamble + brightness (<31 might flicker, see https://cpldcpu.com/2014/11/30/understanding-the-apa102-superled/) */
    g = 0;
-   b = 0;
 
-   if( cur==idx )
+   if( (idx >= first) && (idx < last) )
    {
-    if( (idx == 0) || (idx == (N_KITT_LED-1)))
+    if( (cur == 0) || (cur == (N_KITT_LED-1)))
 	g = r>>5; //     g = r>>2;
    }
 
-   if( rgbmode )
-   {
-    LCD_SPI( r ); // R
-    LCD_SPI( b ); // B
-    LCD_SPI( g ); // G
-   }
-   else
-   {
-    LCD_SPI( b ); // B
-    LCD_SPI( g ); // G
-    LCD_SPI( r ); // R
-   }
-
+   p[0] = r;
+   p[1] = g;
+   p[2] = 0;
   }
 
   return pos;
 }
 
 
-unsigned char LED_update_saturation( unsigned char pos, unsigned char spd, unsigned char rgbmode  )
+unsigned char LED_update_saturation( unsigned char pos, unsigned char spd )
 {
   uint8_t rgb[3],r,g,b;
   int16_t hsv[3];
   int16_t s;
-  unsigned char idx;
+  unsigned char idx,*p;
   unsigned char *rgb_src = led_getcolor( IDX_LED_DIGI, LEDD_STATE );
 
   RGB2HSV( hsv, rgb_src[0], rgb_src[1], rgb_src[2] );
@@ -255,36 +751,30 @@ unsigned char LED_update_saturation( unsigned char pos, unsigned char spd, unsig
 
   HSV2RGB( rgb, hsv[0], s , hsv[2] );
 
-  r = pgm_read_byte(&gamma24_tableLH[rgb[0]][GAMMATAB_H]);
-  g = pgm_read_byte(&gamma24_tableLH[rgb[1]][GAMMATAB_H]);
-  b = pgm_read_byte(&gamma24_tableLH[rgb[2]][GAMMATAB_H]);
+  /* gamma is applied on output (led_digital_poll()) */
+  r = rgb[0];
+  g = rgb[1];
+  b = rgb[2];
 
-  if( rgbmode )
+  p = &ledd_pix[0][0];
+  for( idx = 0 ; idx < ledd_nc ; idx++ )
   {
-    b = pgm_read_byte(&gamma24_tableLH[rgb[0]][GAMMATAB_H]);
-    g = pgm_read_byte(&gamma24_tableLH[rgb[2]][GAMMATAB_H]);
-    r = pgm_read_byte(&gamma24_tableLH[rgb[1]][GAMMATAB_H]);
-  }
-
-  for( idx = 0 ; idx < N_DIGI_LED ; idx++ )
-  {
-	LCD_SPI( LEDD_PREAMBLE ); /* preamble + brightness */
-	LCD_SPI( b );
-	LCD_SPI( g ); /* BGR or BRG */
-	LCD_SPI( r );
+	*p++ = r;
+	*p++ = g;
+	*p++ = b;
   }
 
   return pos+spd;
 }
 
 
-unsigned char LED_update_rainbow( unsigned char pos, unsigned char spd, unsigned char rgbmode  )
+unsigned char LED_update_rainbow( unsigned char pos, unsigned char spd )
 {
   /* pos: "H" in HSV model */
   uint16_t h = ((uint16_t)pos);
   int16_t  v;
   uint8_t rgb[3];
-  unsigned char idx;
+  unsigned char idx,*p;
   unsigned char *rgb0 = led_getcolor( IDX_LED_DIGI, LEDD_STATE );
 
   /* Y0 */
@@ -307,31 +797,14 @@ unsigned char LED_update_rainbow( unsigned char pos, unsigned char spd, unsigned
    }
   }
 
-//  if( spd > 1 )
-	  HSV2RGB( (uint8_t*)rgb, (int16_t)( (h<<2)+ledd_fxstate[0] ), (int16_t)255, v );// (int16_t)255 );
+  HSV2RGB( (uint8_t*)rgb, (int16_t)( (h<<2)+ledd_fxstate[0] ), (int16_t)255, v );
 
-//  h = (h<<2) + ledd_fxstate[0]; 
-  for( idx = 0 ; idx < N_DIGI_LED ; idx++ )
+  p = &ledd_pix[0][0];
+  for( idx = 0 ; idx < ledd_nc ; idx++ )
   {
-	LCD_SPI( LEDD_PREAMBLE ); /* preamble + brightness (<31 might flicker, see https://cpldcpu.com/2014/11/30/understanding-the-apa102-superled/) */
-#if 1
-/*	if( spd == 1 )
-	{
-	  if( h < 1023-4 )
-	  {
-	   HSV2RGB( (uint8_t*)rgb, (int16_t)( h ), (int16_t)255, v );// (int16_t)255 );
-	   h = h+4;
-	  }
-	}
-*/
-	LCD_SPI( rgb[2] ); // B
-	LCD_SPI( rgb[1] ); // G
-	LCD_SPI( rgb[0] ); // R
-#else
-	LCD_SPI( pgm_read_byte( &gamma24_tableLH[rgb[2]][GAMMATAB_H] )); // B
-	LCD_SPI( pgm_read_byte( &gamma24_tableLH[rgb[1]][GAMMATAB_H] )); // G
-	LCD_SPI( pgm_read_byte( &gamma24_tableLH[rgb[0]][GAMMATAB_H] )); // R
-#endif
+	*p++ = rgb[0];
+	*p++ = rgb[1];
+	*p++ = rgb[2];
   }
 
   return pos; /* will wrap around automatically */
@@ -339,174 +812,389 @@ unsigned char LED_update_rainbow( unsigned char pos, unsigned char spd, unsigned
 
 
 
-unsigned char LED_update_dot( unsigned char ledd_cur, unsigned char rgbmode )
+unsigned char LED_update_dot( unsigned char ledd_cur )
 {
- unsigned char idx;
+ unsigned char idx,*p;
  unsigned char *rgb = led_getcolor( IDX_LED_DIGI, LEDD_STATE );
- unsigned char r,g,b;
 
- r = rgb[0];
- g = rgb[1];
- b = rgb[2];
- if( rgbmode )
+ p = &ledd_pix[0][0];
+ for( idx = 0 ; idx < ledd_nc ; idx++, p+=3 )
  {
-	b = rgb[0]; /* red */
-	g = rgb[2]; /* swap r,g for RBG mode */
-	r = rgb[1]; 
- }
-
- for( idx = 0 ; idx < N_DIGI_LED ; idx++ )
- {
-  LCD_SPI( LEDD_PREAMBLE ); /* preamble + brightness (<31 might flicker, see https://cpldcpu.com/2014/11/30/understanding-the-apa102-superled/) */
   if( idx == ledd_cur )
   {
-	LCD_SPI( 0xf1 ); // B
-	if( rgbmode )
-	{
-	 LCD_SPI( 0xff ); // R
-	 LCD_SPI( 0xef ); // G
-	}
-	else
-	{
-	 LCD_SPI( 0xef ); // G
-	 LCD_SPI( 0xff ); // R
-	}
+	p[0] = 0xff; /* white dot */
+	p[1] = 0xef;
+	p[2] = 0xf1;
   }
   else
   {	
-	LCD_SPI( b ); // B
-	LCD_SPI( g ); // G
-	LCD_SPI( r ); // R
+	p[0] = rgb[0];
+	p[1] = rgb[1];
+	p[2] = rgb[2];
   }
  }
 
  /* 1 time step further */
  ledd_cur++;
- if( ledd_cur >= N_DIGI_LED )
+ if( ledd_cur >= ledd_nc )
   	ledd_cur = 0;
 
  return ledd_cur;
 }
 
-unsigned char LED_update_splash( unsigned char ledd_cur, unsigned char rgbmode )
-{
- unsigned char idx,cnt,i,c0,c1,c2;
- unsigned char *rgb = led_getcolor( IDX_LED_DIGI, LEDD_STATE );
- int16_t ledadd[N_DIGI_LED];
- int16_t rs;
-
- //unsigned char ledd_fxkeycolstate[N_DIGI_LED]; /* counter for active keys per column */
- //ledd_fxstate[leftright] = LEDD_SPLASH_INIT;
+/*
+  splash: per key column a kernel that runs outwards from the center of
+  the column, the kernel distances are scaled to the strip length
+  (ledd_dscale), the sum per LED saturates at 255
+
+  LED_update_splash() advances the animation and collects the splashes
+  of the frame, returns 0 when nothing is to be seen; the coverage of
+  the reactive layer (ledd_add) follows per LED with the overlays
+  (LED_splash_cov(), in slices), pressed key columns are fully covered
+*/
+#define SPLASH_WIDTH sizeof(splash_offsets[0])
 
- for( idx = 0 ; idx < N_DIGI_LED ; idx++ )
- {
-	ledadd[idx] = 0;
- }
+unsigned char LED_update_splash( void )
+{
+ unsigned char idx,act;
 
  /* advance time step for animation */
- for( idx = 0, cnt = 0 ; idx < N_DIGI_LED ; idx++ )
+ act = 0;
+ ledd_nspl = 0;
+ for( idx = 0 ; idx < N_DIGI_COL ; idx++ )
  {
-  if( ledd_fxstate[idx] != LEDD_SPLASH_IDLE )
+  if( ledd_splstate[idx] != LEDD_SPLASH_IDLE )
   {
-   cnt++;
-   ledd_fxstate[idx] += 1;
+   if( !ledd_still )
+	ledd_splstate[idx] += 1;
 
-   if( ledd_fxstate[idx] >= SPLASH_ANIM_STEPS )
+   if( ledd_splstate[idx] >= SPLASH_ANIM_STEPS )
    {
-   	ledd_fxstate[idx] = LEDD_SPLASH_IDLE;
+   	ledd_splstate[idx] = LEDD_SPLASH_IDLE;
    }
    else
    {
-	const unsigned char *pos;
+	act = 1;
+	ledd_splkern[ledd_nspl] = &splash_offsets[ledd_splstate[idx]][0];
+	ledd_splctr[ledd_nspl]  = ( ledd_colpix[idx] + ledd_colpix[idx+1] )>>1;
+	ledd_nspl++;
+   }
+  }
+ }
 
-	i = idx;
-	pos = &splash_offsets[ledd_fxstate[idx]][0];
-	while( i > 0 )
+ /* active key columns */
+ ledd_splkey = 0;
+ for( idx = 0 ; idx < N_DIGI_COL ; idx++ )
+ {
+  if( ledd_fxkeycolstate[idx] > 0 )
+  {
+	act = 1;
+	ledd_splkey |= 1<<idx;
+  }
+ }
+
+ return act;
+}
+
+/* coverage of LEDs pos...end-1: left of the center, kernel[0] is at the
+   LED next to it, center and right start at the center */
+static void LED_splash_cov( unsigned char pos, unsigned char end )
+{
+ unsigned char i,s,c,ctr,dist;
+ uint16_t t;
+
+ for( i = pos ; i < end ; i++ )
+ {
+	t = 0;
+	for( s = 0 ; s < ledd_nspl ; s++ )
 	{
-		i--;
-		ledadd[i] += pgm_read_byte(pos++);
+		ctr  = ledd_splctr[s];
+		dist = ( i < ctr ) ? ctr - 1 - i : i - ctr;
+		if( dist < ledd_splreach )
+			t += pgm_read_byte( ledd_splkern[s] + ((dist * ledd_dscale)>>8) );
 	}
-	i = idx;
-	pos = &splash_offsets[ledd_fxstate[idx]][0];
-	while( i < N_DIGI_LED )
+	ledd_add[i] = ( t > 255 ) ? 255 : t;
+ }
+
+ for( c = 0 ; c < N_DIGI_COL ; c++ )
+ {
+	if( !(ledd_splkey & (1<<c)) )
+		continue;
+	for( i = ledd_colpix[c] ; i < ledd_colpix[c+1] ; i++ )
 	{
-		ledadd[i] += pgm_read_byte(pos++);
-		i++;
+		if( (i >= pos) && (i < end) )
+			ledd_add[i] = 0xff;
 	}
-   }
-  }
  }
+}
+
 
- /* idle: don't waste more time */
-// if( !cnt )
-//	return LED_update_dot( N_DIGI_LED );
+/*
+  overlays on top of the base layer (R,G,B per LED), result in ledd_out,
+  the base goes out directly when no overlay is active, else
+  led_digital_poll() composes it in slices (LEDD_PH_COMP) of about the
+  same cost: ~5 units per pixel for the layers, 1 per splash
+
+  8x8 bit fixed point: a = cov*(alpha+1)>>8, then per channel
+   ADD: out = min( out + (rgb*(a+1)>>8), 255 )
+   MIX: out = ( out*(255-a) + rgb*a + 255 ) >> 8
+*/
+void LED_compose( unsigned char *base, unsigned char rgbmode )
+{
+ unsigned char l,n;
 
- if( rgbmode )
+ for( l = 0 ; l < LEDD_NLAYERS ; l++ )
  {
-	c0 = 0; /* RBG */
-	c1 = 2;
-	c2 = 1;
+	if( ledd_layer[l].alpha )
+		break;
  }
- else
+ if( l == LEDD_NLAYERS )
  {
-	c0 = 2; /* BGR */
-	c1 = 1;
-	c2 = 0;
+	LED_output( base, rgbmode );
+	return;
  }
 
- for( idx = 0 ; idx < N_DIGI_LED ; idx++ )
+ n = ( ledd_layer[LEDD_LAYER_REACT].alpha ) ? ledd_nspl : 0;
+ ledd_compstep = LEDD_SLICE_COMP / ( 5 + n );
+ ledd_src      = base;
+ ledd_rgbmode  = rgbmode;
+ ledd_pos      = 0;
+ ledd_phase    = LEDD_PH_COMP;
+}
+
+/* LEDs pos...end-1 */
+static void LED_composite( unsigned char pos, unsigned char end )
+{
+ unsigned char l,i,c,a,*p,*s,*cov;
+ uint16_t v;
+ struct ledd_layer *lay;
+
+ if( ledd_layer[LEDD_LAYER_REACT].alpha )
+	LED_splash_cov( pos, end );
+
+ p = &ledd_out[pos][0];
+ s = ledd_src + pos*3;
+ for( i = pos ; i < end ; i++ )
  {
-  LCD_SPI( LEDD_PREAMBLE ); /* preamble + brightness (<31 might flicker, see https://cpldcpu.com/2014/11/30/understanding-the-apa102-superled/) */
-  if( ledd_fxkeycolstate[idx] > 0 )
-  {
-  	/* active key column */
-	LCD_SPI( 0xf1 ); // B
-	LCD_SPI( 0xff ); // G
-	LCD_SPI( 0xff ); // R
-  }
-  else
-  {
-	 rs = rgb[c0] + ledadd[idx];
-	 LCD_SPI( CLIP(rs) ); // B
-	 rs = rgb[c1] + ledadd[idx];
-	 LCD_SPI( CLIP(rs) ); // G
-	 rs = rgb[c2] + ledadd[idx];
-	 LCD_SPI( CLIP(rs) ); // R
-  }
+	*p++ = *s++;
+	*p++ = *s++;
+	*p++ = *s++;
  }
 
- /* 1 time step further */
- ledd_cur++;
+ for( l = 0, lay = ledd_layer ; l < LEDD_NLAYERS ; l++, lay++ )
+ {
+	if( !lay->alpha )
+		continue;
+	cov = lay->cov;
+	p   = &ledd_out[pos][0];
+	for( i = pos ; i < end ; i++, p += 3 )
+	{
+		a = (cov) ? ( (uint16_t)cov[i] * (lay->alpha+1) )>>8 : lay->alpha;
+		if( !a )
+			continue;
+		if( lay->blend == LEDD_BLEND_ADD )
+		{
+			for( c = 0 ; c < 3 ; c++ )
+			{
+				v = p[c] + ( ((uint16_t)lay->rgb[c] * (a+1))>>8 );
+				p[c] = ( v > 255 ) ? 255 : v;
+			}
+		}
+		else
+		{
+			for( c = 0 ; c < 3 ; c++ )
+				p[c] = ( (uint16_t)p[c] * (255-a) + (uint16_t)lay->rgb[c] * a + 255 ) >> 8;
+		}
+	}
+ }
+}
 
 
- return ledd_cur;
+/*
+  effect program: runs once per canvas pixel, the registers start anew
+  (see led_digital.h), the output registers R,G,B become the pixel
+
+  Branches only go forward, so a pixel takes at most proglen/2
+  instructions. A frame stops at LEDD_VMBUDGET instructions, the pixels
+  not reached keep their last color. asrc/stripvm.c assembles programs
+  and checks them against the budget (keep in sync).
+*/
+static void LED_vm_hue( unsigned char *out, unsigned char h, unsigned char v )
+{
+ uint16_t t = (uint16_t)h * 6;
+ unsigned char up = t & 0xFF, dn = 255 - up;
+ unsigned char r,g,b;
+
+ switch( t >> 8 )
+ {
+	case 0:  r = 255; g = up;  b = 0;   break;
+	case 1:  r = dn;  g = 255; b = 0;   break;
+	case 2:  r = 0;   g = 255; b = up;  break;
+	case 3:  r = 0;   g = dn;  b = 255; break;
+	case 4:  r = up;  g = 0;   b = 255; break;
+	default: r = 255; g = 0;   b = dn;  break;
+ }
+ out[0] = ( (uint16_t)r * (v+1) )>>8;
+ out[1] = ( (uint16_t)g * (v+1) )>>8;
+ out[2] = ( (uint16_t)b * (v+1) )>>8;
 }
 
+static unsigned char LED_vm_pixel( unsigned char i )
+{
+ unsigned char reg[16],pc,d,a,s,cnt,*p;
+ uint16_t v;
+
+ reg[LEDD_VR_I]  = i;
+ reg[LEDD_VR_N]  = ledd_nc;
+ reg[LEDD_VR_T]  = ledd_vmframe;
+ reg[LEDD_VR_CR] = ledd_vmcol[0];
+ reg[LEDD_VR_CG] = ledd_vmcol[1];
+ reg[LEDD_VR_CB] = ledd_vmcol[2];
+ for( d = LEDD_VR_X0 ; d < 16 ; d++ )
+	reg[d] = 0;
+
+ for( pc = 0, cnt = 0 ; pc < ledd_proglen ; pc += 2, cnt++ )
+ {
+	d = ledd_prog[pc] & 0xF;
+	a = ledd_prog[pc+1];
+	s = reg[a & 0xF];
+	switch( ledd_prog[pc] >> 4 )
+	{
+		case LEDD_VM_LDI:  reg[d] = a; break;
+		case LEDD_VM_MOV:  reg[d] = s; break;
+		case LEDD_VM_ADD:  reg[d] += s; break;
+		case LEDD_VM_ADDS: v = reg[d] + s; reg[d] = ( v > 255 ) ? 255 : v; break;
+		case LEDD_VM_SUB:  reg[d] -= s; break;
+		case LEDD_VM_SUBS: reg[d] = ( reg[d] > s ) ? reg[d] - s : 0; break;
+		case LEDD_VM_MUL:  reg[d] = ( (uint16_t)reg[d] * (s+1) )>>8; break;
+		case LEDD_VM_ADDI: reg[d] += a; break;
+		case LEDD_VM_MULI: reg[d] = ( (uint16_t)reg[d] * (a+1) )>>8; break;
+		case LEDD_VM_SHL:  reg[d] <<= (a & 7); break;
+		case LEDD_VM_SHR:  reg[d] >>= (a & 7); break;
+		case LEDD_VM_TRI:  reg[d] = ( s & 0x80 ) ? (255-s)<<1 : s<<1; break;
+		case LEDD_VM_HUE:  LED_vm_hue( &reg[LEDD_VR_R], s, reg[d] ); break;
+		case LEDD_VM_SKLT: if( reg[d] <  s ) pc += 2; break;
+		case LEDD_VM_SKEQ: if( reg[d] == s ) pc += 2; break;
+		default: /* LEDD_VM_JMP */
+			if( a == 0xFF )
+				pc = ledd_proglen;
+			else	pc += a<<1;
+			break;
+	}
+ }
+
+ p = &ledd_pix[i][0];
+ p[0] = reg[LEDD_VR_R];
+ p[1] = reg[LEDD_VR_G];
+ p[2] = reg[LEDD_VR_B];
+
+ return cnt;
+}
+
+/*
+  new program: whole instructions, jumps must stay within the program
+  (the skips of SKLT/SKEQ may step onto the end), n = 0 clears it
+*/
+unsigned char led_digital_setprog( unsigned char *buf, unsigned char n )
+{
+ unsigned char pc;
+
+ if( (n & 1) || (n > LEDD_PROGMAX) )
+	return 0;
+ for( pc = 0 ; pc < n ; pc += 2 )
+ {
+	if( ((buf[pc]>>4) == LEDD_VM_JMP) && (buf[pc+1] != 0xFF) &&
+	    ( (uint16_t)pc + 2 + ((uint16_t)buf[pc+1]<<1) > n ) )
+		return 0;
+ }
+
+ for( pc = 0 ; pc < n ; pc++ )
+	ledd_prog[pc] = buf[pc];
+ ledd_proglen = n;
+ if( ledd_phase == LEDD_PH_VM )
+	ledd_phase = LEDD_PH_IDLE; /* frame with the old program is dropped */
+
+ return 1;
+}
+
+unsigned char led_digital_getprog( unsigned char **buf )
+{
+ *buf = ledd_prog;
+ return ledd_proglen;
+}
+
+
+/*
+  strip length: LED range of each key column, splash kernel scale and
+  KITT length follow, the next frame is sent in any case
+*/
+void led_digital_setlength( unsigned char n )
+{
+ unsigned char c;
+
+ if( !n )
+	n = N_DIGI_LED;
+ if( n > LEDD_MAXLED )
+	n = LEDD_MAXLED;
+ ledd_n = n;
+
+ for( c = 0 ; c <= N_DIGI_COL ; c++ )
+	ledd_colpix[c] = ( (uint16_t)c * n ) / N_DIGI_COL;
+
+ ledd_dscale = ( N_DIGI_COL*256 + (n>>1) ) / n;
+ ledd_splreach = ( SPLASH_WIDTH*256 - 1 ) / ledd_dscale + 1;
+ LED_canvasgeom();
+
+ ledd_refresh = 0;
+ ledd_phase   = LEDD_PH_IDLE;
+}
+
+/* canvas length and what follows it (KITT length) */
+static void LED_canvasgeom( void )
+{
+ ledd_nc    = ledd_npre + ledd_n;
+ ledd_nkitt = ( (uint16_t)ledd_nc * N_KITT_LED + (N_DIGI_LED>>1) ) / N_DIGI_LED;
+ if( !ledd_nkitt )
+	ledd_nkitt = 1;
+ ledd_cur   = 0;
+}
+
+/* pixel i of the canvas (i < N_LED: analog LEDs, valid while one of them
+   is in LEDM_CANVAS) */
+unsigned char *led_digital_canvas( unsigned char i )
+{
+ return &ledd_pix[i][0];
+}
+
+unsigned char led_digital_getlength( void )
+{
+ return ledd_n;
+}
 
 
 /* reset (start frame) string to LCD row */
 void LED_Start_Frame()
 {
-     LCD_SPI( 0 );
-     LCD_SPI( 0 );
-     LCD_SPI( 0 );
-     LCD_SPI( 0 );
+     LEDD_OUT( 0 );
+     LEDD_OUT( 0 );
+     LEDD_OUT( 0 );
+     LEDD_OUT( 0 );
 }
 
 void LED_Stop_Frame( unsigned char nled )
 {
 
      /* SK9822 end frame (=reset) */
-     LCD_SPI( 0 );
-     LCD_SPI( 0 );
-     LCD_SPI( 0 );
-     LCD_SPI( 0 );
+     LEDD_OUT( 0 );
+     LEDD_OUT( 0 );
+     LEDD_OUT( 0 );
+     LEDD_OUT( 0 );
 
      /* APA102 end frame */
      /* TODO: we should only need nled/2 zeroes */
      while( 1 )
      {
-	 LCD_SPI( 0 );
+	 LEDD_OUT( 0 );
 
 	 if( nled < 8 )
 	 	break;
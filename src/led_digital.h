@@ -4,10 +4,77 @@
 
 #include "kbdefs.h"
 
-/* number of LEDs */
+/* number of LEDs (default), maximum strip length, key columns (kbleftright) */
 #define N_DIGI_LED         15
+#define LEDD_MAXLED        144
+#define N_DIGI_COL         15
 
 char led_digital_step();
+/* output of the current frame in slices (~100 us), call in every loop pass */
+void led_digital_poll( void );
 void led_digital_updown(unsigned char code, unsigned char leftright);
 
+/* strip length (1...LEDD_MAXLED), key columns and effects are scaled to it */
+void led_digital_setlength( unsigned char n );
+unsigned char led_digital_getlength( void );
+
+/* canvas pixel of analog LED i (R,G,B), see LEDM_CANVAS in led.h */
+unsigned char *led_digital_canvas( unsigned char i );
+
+/* notification layer on top of the strip (LEDCMD_EXT+LEDX_STRIPNOTE) */
+void led_digital_notify( unsigned char alpha, unsigned char r, unsigned char g, unsigned char b, unsigned char frames );
+
+/* streamed frames from host (LEDCMD_EXT+LEDX_FRAME), shown by led_digital_step() */
+void led_digital_putframe( unsigned char *buf, unsigned char n );
+
+/* frame opcodes, applied to the back buffer from pixel 0 onwards
+   (keep in sync with asrc/stripframe.h) */
+#define LEDD_OP_RUN  0x80 /* 1lllpppp: l+1 pixels of palette color p  */
+#define LEDD_OP_SKIP 0x40 /* 01ssssss: skip s+1 pixels (unchanged)     */
+#define LEDD_OP_PAL  0x20 /* 0010pppp R,G,B: define palette color p    */
+#define LEDD_OP_RGB  0x01 /* R,G,B: one pixel, direct color            */
+#define LEDD_OP_OFF  0x00 /* end streaming, back to built-in effects   */
+#define LEDD_NPAL    16
+
+/* effect program (LEDCMD_EXT+LEDX_SETPROG, strip mode LEDD_FX_PROG), runs
+   once per canvas pixel and frame, returns 1 if accepted
+   (keep in sync with asrc/stripvm.c) */
+unsigned char led_digital_setprog( unsigned char *buf, unsigned char n );
+unsigned char led_digital_getprog( unsigned char **buf );
+
+#define LEDD_PROGMAX   96   /* bytes, 2 per instruction */
+#define LEDD_VMBUDGET  2048 /* instructions per frame */
+
+/* instruction: byte 0 = opcode<<4 | destination register, byte 1 = source
+   register (lower 4 bits) or immediate, all values 8 bit unsigned,
+   MUL: d = d*(s+1)>>8 (255 = 1.0), branches go forward only */
+#define LEDD_VM_LDI  0x0 /* d = imm                          */
+#define LEDD_VM_MOV  0x1 /* d = s                            */
+#define LEDD_VM_ADD  0x2 /* d = d + s (wraps)                */
+#define LEDD_VM_ADDS 0x3 /* d = d + s (saturates at 255)     */
+#define LEDD_VM_SUB  0x4 /* d = d - s (wraps)                */
+#define LEDD_VM_SUBS 0x5 /* d = d - s (saturates at 0)       */
+#define LEDD_VM_MUL  0x6 /* d = d * s                        */
+#define LEDD_VM_ADDI 0x7 /* d = d + imm (wraps)              */
+#define LEDD_VM_MULI 0x8 /* d = d * imm                      */
+#define LEDD_VM_SHL  0x9 /* d = d << imm (0...7)             */
+#define LEDD_VM_SHR  0xA /* d = d >> imm (0...7)             */
+#define LEDD_VM_TRI  0xB /* d = triangle wave of s (0...254) */
+#define LEDD_VM_HUE  0xC /* R,G,B = color wheel at s, value d */
+#define LEDD_VM_SKLT 0xD /* skip next instruction if d < s   */
+#define LEDD_VM_SKEQ 0xE /* skip next instruction if d == s  */
+#define LEDD_VM_JMP  0xF /* skip imm instructions, 0xFF = end of program */
+
+/* registers, all set anew per pixel */
+#define LEDD_VR_I   0  /* pixel on the canvas (0...N-1)          */
+#define LEDD_VR_N   1  /* number of pixels on the canvas         */
+#define LEDD_VR_T   2  /* frame counter                          */
+#define LEDD_VR_CR  3  /* strip color (R,G,B)                    */
+#define LEDD_VR_CG  4
+#define LEDD_VR_CB  5
+#define LEDD_VR_X0  6  /* scratch X0...X6, 0 at start            */
+#define LEDD_VR_R   13 /* output R,G,B, 0 at start               */
+#define LEDD_VR_G   14
+#define LEDD_VR_B   15
+
 #endif
@@ -84,7 +84,9 @@ unsigned char *recv_commands(unsigned char *nrecv);
 unsigned char kbtable[(OCOUNT+OCOUNT_SPC)*ICOUNT];
 
 /* commands from Amiga, USB LED configuration */
-#define RECVBUFSIZE 32 
+/* Note: nrecv&0x80 flags receive errors, hence 127 bytes max.
+         Since V11/12, this allows up to 6 LEDs (19 bytes each) per stream */
+#define RECVBUFSIZE 127
 unsigned char recv_buffer[RECVBUFSIZE];
 
 #define KEYIDLE 0 /* keyidle / keydown should only use one bit (!) */
@@ -254,6 +256,7 @@ KEY_KPMINUS,KEY_KP0, KEY_KP1, KEY_KP4, KEY_KP7, KEY_KPENTER, KEY_KP2, KEY_KP5, K
 #define COMM_ACK1  0x7B
 #define COMM_NACK  0x77
 #define COMM_NACK1 0x7F
+#define COMM_NOTIFY 0x75 /* source state change, followed by state|0x80 */
 
 #if 0
 /* ~  1    ESC  F1   F2   F3   F4   F5   F6   F7   F8   F9   F10    */
@@ -447,8 +450,10 @@ void mainloop_usb(void)
   led_setinputstate( LEDF_SRC_FLOPPY, 0 );
   led_setinputstate( LEDF_SRC_IN3,    0 );
   led_setinputstate( LEDF_SRC_CAPS,   0 );
+  led_setinputstate( LEDF_SRC_PDIM,   0 );
   st = led_setinputstate( LEDF_SRC_IN4,    0 );
-  led_updatecontroller(st|LED_FORCE_UPDATE); /* */
+  led_forceupdate();
+  led_updatecontroller(st); /* */
 
   mod1=0;
   act0=0;
@@ -461,6 +466,16 @@ void mainloop_usb(void)
 #ifdef ENABLE_WATCHDOG
 	wdt_reset();    /* we're alive (!) */
 #endif
+
+	/* LED animations and fades run on the same time base as in Amiga mode */
+	if( TIFR2 & 0x01 ) /* timer overflow (16.3ms) ? */
+	{
+		TIFR2  = 0x01; /* clear TOV0 overflow flag (write 1 to set flag to 0) */
+		led_digital_step();
+		led_animate();
+	}
+	led_digital_poll(); /* one slice of the strip frame */
+
 	for( j=OSTART; j != 0 ; j <<= 1 )
 	{
 	  if( !(j & OMASK ) )	/* oport bit inactive ? */
@@ -718,11 +733,10 @@ int main(void)
   }
 #endif
 
-  /* prime LED controller: all on, then all off */
-  twi_wait();
-  led_updatecontroller(0xff); /* update will only start if TWI is idle */
+  /* prime LED controller: all on, then all off (queued behind init) */
+  led_forceupdate();
+  led_updatecontroller(0xff);
   inputstate = led_getinputstate();
-  twi_wait();
   led_updatecontroller(inputstate);
 
   /* print HSV2RGB conversion */
@@ -774,7 +788,9 @@ int main(void)
 	 {
 		TIFR2  = 0x01; /* clear TOV0 overflow flag (write 1 to set flag to 0) */
 		led_digital_step();
+		led_animate();
 	 }
+	 led_digital_poll(); /* one slice of the strip frame */
 
 #ifdef ENABLE_USB
 		/* jump to USB main loop when USB connection was established */
@@ -981,6 +997,7 @@ int main(void)
 					led_digital_updown( code, pgm_read_byte(&kbleftright[pos]) );
 				}
 				DBGOUT( pgm_read_byte(&debuglist[pos] )  )
+				led_activity();    /* restart idle dimming */
 				kbtable[pos] = cur; /* store key, no timeout */
 			}
 			else /* remember debounce count */
@@ -1081,6 +1098,17 @@ int main(void)
 
 		if( keyb_idle > 5 )
 		{
+			/* tell the host about changed sources (if it asked for it) */
+			if( !need_confeeprom )
+			{
+				unsigned char ncode = led_notifystate( inputstate );
+				if( ncode )
+				{
+					write_ring( COMM_NOTIFY | 0x80 );
+					write_ring( ncode );
+					keyb_idle = 0; /* let the notification go out before listening again */
+				}
+			}
 
 			/* check if there is a command from remote end */
 			if( !(KBDSEND_ACKPIN & (1<<KBDSEND_ACKB)) )	/* data low ? */
@@ -1118,6 +1146,18 @@ int main(void)
 							uart1_puts(" ");
 						}
 						uart1_puts("\r\n");
+#ifdef TWI_ISRTIME
+						uart1_puts("TWI ISR max cycles: ");
+						uart_puthexuint( twi_isrmax );
+						uart1_puts("\r\n");
+#endif
+						uart1_puts("TWI bytes/s, retries, errors: ");
+						uart_puthexuint( twi_bps );
+						uart1_puts(" ");
+						uart_puthexuint( twi_retries );
+						uart1_puts(" ");
+						uart_puthexuint( twi_geterrors() );
+						uart1_puts("\r\n");
 #endif
 						/* 
 							We need to save the configuration. This may take a while.
@@ -1158,13 +1198,12 @@ int main(void)
 
 		if( keyb_idle > 1024 )
 	 	{
-			inputstate |= LED_FORCE_UPDATE;
+			led_forceupdate();
 			keyb_idle = 5;
 		}
 
 	}
 	led_updatecontroller(inputstate); /* */
-	inputstate &= ~(LED_FORCE_UPDATE);
 
 	/* --------------------------------------------------------------------- */
 	/* check CTRL-LAMIGA-LAMIGA                                              */
@@ -1201,6 +1240,8 @@ int main(void)
 			KBDSEND_RSTDDR |=  (1<<KBDSEND_RSTB); /* output */
 			KBDSEND_RSTP   &= ~(1<<KBDSEND_RSTB); /* /RST */
 #endif
+			led_setinputstate( LEDF_SRC_VIRT, 0 ); /* host software is gone */
+			led_setnotify( 0 );
 			KBDSEND_CLKD |=  (1<<KBDSEND_CLKB);  /* switch to output */
 			KBDSEND_CLKP &= ~(1<<KBDSEND_CLKB);  /* clock low */
 			state &= ~(STATE_KBWAIT|STATE_KBWAIT2); /* no longer wait for KB ACK */
@@ -1397,7 +1438,9 @@ char amiga_kbsync( void )
 	{
 		TIFR2  = 0x01; /* clear TOV0 overflow flag (write 1 to set flag to 0) */
 		led_digital_step();
+		led_animate();
 	}
+	led_digital_poll();
 
  	if( !(KBDSEND_ACKPIN & (1<<KBDSEND_ACKB)) )
  		break;
@@ -1428,7 +1471,9 @@ char amiga_kbsync( void )
 	{
 		TIFR2  = 0x01; /* clear TOV0 overflow flag (write 1 to set flag to 0) */
 		led_digital_step();
+		led_animate();
 	}
+	led_digital_poll();
 
 	if( (KBDSEND_ACKPIN & (1<<KBDSEND_ACKB)) )
 		break;
@@ -1672,6 +1717,9 @@ unsigned char *recv_commands(unsigned char *nrecv)
 				bitcount = 0;
 				recbits  = 0;
 				TCNT0 = 0x00; /* restart timer */
+#ifdef ENABLE_WATCHDOG
+				wdt_reset(); /* long streams take >100ms */
+#endif
 			}
 
 			bitcount++;
@@ -47,9 +47,16 @@
 
 *********************************************************************************** */
 #include <avr/pgmspace.h>
+#include <avr/interrupt.h>
 #include <util/delay.h> /* might be <avr/delay.h>, depending on toolchain */
 #include "spi.h"
 
+#ifndef _LCD_SOFT_SPI
+static unsigned char *spi_ptr;          /* next byte of LCD_SPI_Send() */
+static uint16_t spi_left;               /* bytes still to go */
+static volatile unsigned char spi_busy; /* 1 = transfer running */
+#endif
+
 void LCD_SPI_Start()
 {
 	BitSet( LCD_DDR_CLK,  LCD_PIN_CLK  );
@@ -62,7 +69,8 @@ void LCD_SPI_Start()
 	/* */
 	SPSR |= 1;  /* enable double speed  */ // 
 	//SPSR &= ~1; /* disable double speed */
-	SPCR  = (0<<SPIE)|(1<<SPE)|(0<<DORD)|(1<<MSTR)|(0<<CPOL)|(0<<CPHA)|(1<<SPR1)|(0<<SPR0);	
+	SPCR  = (0<<SPIE)|(1<<SPE)|(0<<DORD)|(1<<MSTR)|(0<<CPOL)|(0<<CPHA)|(0<<SPR1)|(0<<SPR0); /* 8 MHz */
+	spi_busy = 0;
 #endif
 }
 
@@ -139,5 +147,56 @@ inline void LCD_SPI(unsigned char data)
 }
 #endif /* _LCD_SOFT_SPI */
 
+/*
+  buffer output
+
+  hardware SPI: the first byte is written here, the transfer complete 
+  interrupt writes the others (one byte per 1 us at 8 MHz, the interrupt
+  takes ~2.5 us, i.e. the bytes follow each other as fast as the
+  interrupt allows while the main loop goes on), SPIE is cleared after
+  the last byte so that LCD_SPI() may poll SPIF again
+*/
+#ifdef _LCD_SOFT_SPI
+void LCD_SPI_Send( unsigned char *buf, uint16_t n )
+{
+	while( n-- )
+		LCD_SPI( *buf++ );
+}
+
+unsigned char LCD_SPI_Busy( void )
+{
+	return 0;
+}
+#else /* _LCD_SOFT_SPI */
+void LCD_SPI_Send( unsigned char *buf, uint16_t n )
+{
+	if( !n )
+		return;
+	while( spi_busy );
+
+	spi_ptr  = buf+1;
+	spi_left = n;
+	spi_busy = 1;
+	SPCR    |= (1<<SPIE);
+	SPDR     = *buf;
+}
+
+unsigned char LCD_SPI_Busy( void )
+{
+	return spi_busy;
+}
+
+ISR(SPI_STC_vect)
+{
+	if( --spi_left )
+		SPDR = *spi_ptr++;
+	else
+	{
+		SPCR &= ~(1<<SPIE); /* done */
+		spi_busy = 0;
+	}
+}
+#endif /* _LCD_SOFT_SPI */
+
 
 
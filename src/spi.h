@@ -65,9 +65,11 @@
 
 
 /* ******************************************************************************** */
-#if 1
+#ifdef _LCD_SOFT_SPI
 /*
-
+  A500KB: LED strip on PA1 (CLK), PA0 (DATA). The hardware SPI pins (SS/SCK/MOSI = 
+  PB0/PB1/PB2) carry modifier key inputs and USART1 (TXD1/XCK1 = PD3/PD5) the 
+  keyboard data line, so hardware SPI requires a board with the strip on SCK/MOSI
 */
 #define LCD_PORT_CLK  PORTA
 #define LCD_DDR_CLK   DDRA
@@ -75,6 +77,14 @@
 #define LCD_PORT_DATA PORTA
 #define LCD_DDR_DATA  DDRA
 #define LCD_PIN_DATA  0 
+#else
+/* hardware SPI: SCK = PB1, MOSI = PB2, SS (PB0) must stay high or be an output */
+#define LCD_PORT_CLK  PORTB
+#define LCD_DDR_CLK   DDRB
+#define LCD_PIN_CLK   1
+#define LCD_PORT_DATA PORTB
+#define LCD_DDR_DATA  DDRB
+#define LCD_PIN_DATA  2
 #endif
 
 /* this #define, if not commented out enables the fast software SPI write routine 
@@ -92,6 +102,12 @@
 void LCD_SPI_Start();
 void LCD_SPI( unsigned char dta );
 
+/* send n bytes from buffer: hardware SPI returns at once, the buffer is
+   fed by the transfer complete interrupt and must stay untouched until
+   LCD_SPI_Busy() returns 0 (software SPI: returns when done) */
+void LCD_SPI_Send( unsigned char *buf, uint16_t n );
+unsigned char LCD_SPI_Busy( void );
+
 /* ******************************************************************************** */
 /*
    Functions
@@ -1,37 +1,152 @@
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <util/twi.h>
+#include <util/delay.h>
 #include <string.h>
 
 #include "twi.h"
 
-static volatile uint8_t busy;
+#if (F_CPU / TWI_FREQ) < 16
+#error "TWI_FREQ too high for F_CPU"
+#endif
+#if (TWI_QUEUE & (TWI_QUEUE-1))
+#error "TWI_QUEUE must be a power of 2"
+#endif
+
+/* TWI pins of the AT90USB1287 (bus clear after timeout) */
+#define TWI_DDR  DDRD
+#define TWI_PIN  PIND
+#define TWI_SCL  0
+#define TWI_SDA  1
+
+static volatile uint8_t tries;    /* remaining retries of current transaction */
+static volatile uint16_t bytecount;
+static volatile uint8_t busyticks;
+static uint8_t secticks;
+volatile uint16_t twi_bps;
+volatile uint16_t twi_retries;
+volatile uint16_t twi_errors;
+#ifdef TWI_ISRTIME
+volatile uint16_t twi_isrmax;
+#endif
+
+/*
+  transaction queue: producers fill the slot behind the last queued
+  transaction and move on, the ISR works through the queue and chains
+  the transactions (STOP+START in one go), head = current transaction
+
+  head+count stays the same while the ISR completes transactions, so a
+  producer may fill the free slot with interrupts enabled
+*/
 static struct {
   uint8_t buffer[TWI_BUFFER_LENGTH];
   uint8_t length;
-  uint8_t index;
   void (*callback)(uint8_t, uint8_t *);
-} transmission;
+} queue[TWI_QUEUE];
+static volatile uint8_t head;
+static volatile uint8_t count;
+static volatile uint8_t qindex;    /* position in current transaction */
+static uint8_t *lastdata;         /* data of last completed transaction */
 
 void twi_init() {
   TWBR = ((F_CPU / TWI_FREQ) - 16) / 2;
   TWSR = 0; // prescaler = 1
 
-  busy = 0;
+  head  = 0;
+  count = 0;
+  lastdata = &queue[0].buffer[1];
 
-  sei(); 
+#ifdef TWI_ISRTIME
+  TCCR1A = 0;
+  TCCR1B = _BV(CS10); /* free running at clk/1 */
+  twi_isrmax = 0;
+#endif
+
+  sei();
 
   TWCR = _BV(TWEN);
 }
 
+/*
+  bus reset: release the TWI pins, clock out a slave that holds SDA low
+  (up to 9 SCL pulses), then restart the TWI unit, queued transactions
+  are dropped
+*/
+static void twi_reset(void) {
+  uint8_t i;
+
+  TWCR = 0;
+  for (i = 0; (i < 9) && !(TWI_PIN & _BV(TWI_SDA)); i++) {
+    TWI_DDR |= _BV(TWI_SCL);   /* SCL low (port bit is 0) */
+    _delay_us(5);
+    TWI_DDR &= ~_BV(TWI_SCL);  /* SCL released */
+    _delay_us(5);
+  }
+  TWCR = _BV(TWEN);
+
+  twi_errors += count;
+  busyticks = 0;
+  count = 0;
+}
+
+/* wait until the queue has less than n transactions (with timeout) */
+static void twi_waitqueue(uint8_t n) {
+  uint16_t t = TWI_TIMEOUT_US / 10;
+
+  while (count >= n) {
+    if (!t--) {
+      twi_reset();
+      break;
+    }
+    _delay_us(10);
+  }
+}
+
 uint8_t *twi_wait() {
-  while (busy);
-  return &transmission.buffer[1];
+  twi_waitqueue(1);
+  return lastdata;
+}
+
+void twi_tick() {
+  uint8_t sreg;
+
+  if (count) {
+    if (++busyticks >= TWI_TIMEOUT_TICKS)
+      twi_reset();
+  } else
+    busyticks = 0;
+
+  if (++secticks >= TWI_TICKS_PER_S) {
+    secticks = 0;
+    sreg = SREG;
+    cli();
+    twi_bps = bytecount;
+    bytecount = 0;
+    SREG = sreg;
+  }
 }
 
 uint8_t twi_isbusy()
 {
- return busy;
+ return count;
+}
+
+uint8_t twi_queuefree()
+{
+ return TWI_QUEUE - count;
+}
+
+uint16_t twi_geterrors()
+{
+ uint16_t n;
+ uint8_t sreg;
+
+ sreg = SREG;
+ cli();
+ n = twi_errors;
+ SREG = sreg;
+
+ return n;
 }
 
 void twi_start(void) {
@@ -42,6 +157,11 @@ void twi_stop(void) {
   TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWSTO);
 }
 
+/* STOP, followed by START of the next transaction */
+void twi_stopstart(void) {
+  TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWIE) | _BV(TWSTO) | _BV(TWSTA);
+}
+
 void twi_ack() {
   TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWIE) | _BV(TWEA);
 }
@@ -55,66 +175,98 @@ void twi_send(uint8_t data) {
 }
 
 void twi_recv() {
-  transmission.buffer[transmission.index++] = TWDR;
+  queue[head].buffer[qindex++] = TWDR;
+  bytecount++;
 }
 
 void twi_reply() {
-  if (transmission.index < (transmission.length - 1)) {
+  if (qindex < (queue[head].length - 1)) {
     twi_ack();
   } else {
     twi_nack();
   }
 }
 
+/* current transaction finished (or given up): callback, chain next one */
 void twi_done() {
-  uint8_t address = transmission.buffer[0] >> 1;
-  uint8_t *data = &transmission.buffer[1];
+  uint8_t address = queue[head].buffer[0] >> 1;
+  uint8_t *data = &queue[head].buffer[1];
 
-  busy = 0;
+  if (queue[head].callback != NULL) {
+    queue[head].callback(address, data);
+  }
+  lastdata = data;
 
-  if (transmission.callback != NULL) {
-    transmission.callback(address, data);
+  head = (head + 1) & (TWI_QUEUE - 1);
+  busyticks = 0;
+  qindex = 0;
+  tries = TWI_RETRIES;
+  if (--count)
+    twi_stopstart();
+  else
+    twi_stop();
+}
+
+/* failed: repeat the whole transaction (repeated start) or give up */
+void twi_retry() {
+  if (tries) {
+    tries--;
+    twi_retries++;
+    qindex = 0;
+    twi_start();
+  } else {
+    twi_errors++;
+    twi_done();
   }
 }
 
-void twi_write(uint8_t address, uint8_t* data, uint8_t length, void (*callback)(uint8_t, uint8_t *)) {
-  twi_wait();
+/* append transaction to queue (waits only if the queue is full) */
+static void twi_enqueue(uint8_t sla, uint8_t* data, uint8_t length, void (*callback)(uint8_t, uint8_t *)) {
+  uint8_t slot,sreg;
+
+  twi_waitqueue(TWI_QUEUE);
 
-  busy = 1;
+  slot = (head + count) & (TWI_QUEUE - 1);
+  queue[slot].buffer[0] = sla;
+  queue[slot].length = length + 1;
+  queue[slot].callback = callback;
+  if (data)
+    memcpy(&queue[slot].buffer[1], data, length);
 
-  transmission.buffer[0] = (address << 1) | TW_WRITE;
-  transmission.length = length + 1;
-  transmission.index = 0;
-  transmission.callback = callback;
-  memcpy(&transmission.buffer[1], data, length);
+  sreg = SREG;
+  cli();
+  if (!count++) {
+    /* queue was idle: start right away */
+    busyticks = 0;
+    qindex = 0;
+    tries = TWI_RETRIES;
+    twi_start();
+  }
+  SREG = sreg;
+}
 
-  twi_start();
+void twi_write(uint8_t address, uint8_t* data, uint8_t length, void (*callback)(uint8_t, uint8_t *)) {
+  twi_enqueue((address << 1) | TW_WRITE, data, length, callback);
 }
 
 void twi_read(uint8_t address, uint8_t length, void (*callback)(uint8_t, uint8_t *)) {
-  twi_wait();
-
-  busy = 1;
-
-  transmission.buffer[0] = (address << 1) | TW_READ;
-  transmission.length = length + 1;
-  transmission.index = 0;
-  transmission.callback = callback;
-
-  twi_start();
+  twi_enqueue((address << 1) | TW_READ, NULL, length, callback);
 }
 
 ISR(TWI_vect) {
+#ifdef TWI_ISRTIME
+  uint16_t t0 = TCNT1;
+#endif
   switch (TW_STATUS) {
   case TW_START:
   case TW_REP_START:
   case TW_MT_SLA_ACK:
   case TW_MT_DATA_ACK:
-    if (transmission.index < transmission.length) {
-      twi_send(transmission.buffer[transmission.index++]);
+    if (qindex < queue[head].length) {
+      twi_send(queue[head].buffer[qindex++]);
+      bytecount++;
       twi_nack();
     } else {
-      twi_stop();
       twi_done();
     }
     break;
@@ -130,16 +282,28 @@ ISR(TWI_vect) {
 
   case TW_MR_DATA_NACK:
     twi_recv();
-    twi_stop();
     twi_done();
     break;
 
   case TW_MT_SLA_NACK:
   case TW_MR_SLA_NACK:
   case TW_MT_DATA_NACK:
+  case TW_MT_ARB_LOST: /* same code as TW_MR_ARB_LOST, start waits for free bus */
+    twi_retry();
+    break;
+
+  case TW_BUS_ERROR:   /* illegal start/stop: stop releases the bus */
+    twi_errors++;
+    twi_done();
+    break;
+
   default:
-    twi_stop();
     twi_done();
     break;
   }
+#ifdef TWI_ISRTIME
+  t0 = TCNT1 - t0;
+  if (t0 > twi_isrmax)
+    twi_isrmax = t0;
+#endif
 }
@@ -3,18 +3,66 @@
 
 #include <stdint.h>
 
+/* 400 kHz fast mode, the IS31FL3237 also takes 1 MHz (fast mode plus,
+   needs strong pull-ups): -DTWI_FREQ=1000000UL */
 #ifndef TWI_FREQ
-#define TWI_FREQ 200000UL
+#define TWI_FREQ 400000UL
+#endif
+
+/* retries of a transaction after NACK or arbitration loss (a bus error
+   ends the transaction right away, counted in twi_errors) */
+#ifndef TWI_RETRIES
+#define TWI_RETRIES 3
+#endif
+
+/* busy for this many twi_tick() calls: reset the bus */
+#ifndef TWI_TIMEOUT_TICKS
+#define TWI_TIMEOUT_TICKS 3
+#endif
+/* twi_wait() gives up after this time (us) */
+#ifndef TWI_TIMEOUT_US
+#define TWI_TIMEOUT_US 20000
 #endif
 
 #ifndef TWI_BUFFER_LENGTH
-#define TWI_BUFFER_LENGTH 32
+#define TWI_BUFFER_LENGTH 48 /* SLA + register + 42 PWM bytes (7 LEDs) in one burst */
+#endif
+
+/* queued transactions (power of 2), each with its own buffer */
+#ifndef TWI_QUEUE
+#define TWI_QUEUE 8
 #endif
 
 void twi_init();
+
+/* queue a transaction and return (the data is copied), the callback is
+   called from the TWI interrupt when done; blocks only when the queue is full */
 void twi_write(uint8_t address, uint8_t* data, uint8_t length, void (*callback)(uint8_t, uint8_t *) );
 void twi_read(uint8_t address, uint8_t length, void (*callback)(uint8_t, uint8_t *));
+
+/* wait until all queued transactions are done, returns data of the last one */
 uint8_t *twi_wait();
+/* number of queued transactions (0 = idle) */
 uint8_t twi_isbusy();
+/* free queue slots */
+uint8_t twi_queuefree();
+
+/* call on every timer 2 overflow (16.3 ms): bus timeout, statistics */
+void twi_tick();
+#define TWI_TICKS_PER_S 61
+
+/* statistics: bytes on the bus in the last second, retries and failed
+   transactions (after retries, bus error or timeout) since start,
+   written from the TWI interrupt */
+extern volatile uint16_t twi_bps;
+extern volatile uint16_t twi_retries;
+extern volatile uint16_t twi_errors;
+/* twi_errors, read with interrupts off (no torn 16 bit value) */
+uint16_t twi_geterrors();
+
+#ifdef TWI_ISRTIME
+/* longest TWI interrupt so far in CPU cycles (timer 1 at clk/1) */
+extern volatile uint16_t twi_isrmax;
+#endif
 
 #endif